@@ -0,0 +1,106 @@
+//==============================================================================
+//
+// 画像コーデックのインターフェイス
+//
+//==============================================================================
+#ifndef _I_IMAGE_CODEC_H_
+#define _I_IMAGE_CODEC_H_
+
+#include "miImage.h"
+#include "IImageReaderWriter.h"
+
+#include <istream>
+#include <ostream>
+#include <memory>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// デコーダ
+//
+// MEMO:
+// ReadHeader でヘッダだけを読み込み、その後 ReadRows で必要な行だけを
+// 呼び出し側が用意したバッファへ展開する (画像全体を保持しない)
+//------------------------------------------------------------------------------
+class IImageDecoder {
+public:
+    virtual ~IImageDecoder() {}
+
+    // ヘッダを読み込んで検証する (対応していなければ例外を投げる)
+    // stream は ReadRows が終わるまで有効でなければならない
+    virtual ImageInfo ReadHeader(std::istream& stream) = 0;
+
+    // startRow 行目 (上から数える) から numRows 行を pixels へ展開する
+    // pixels は width*numRows 個, alpha は nullptr でなければ width*numRows 個
+    virtual void ReadRows(int startRow, int numRows, RGB* pixels, unsigned char* alpha = nullptr) = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// エンコーダ
+//
+// MEMO:
+// Begin の後、上の行から順に WriteRows を何回かに分けて呼び、最後に End を呼ぶ
+//------------------------------------------------------------------------------
+class IImageEncoder {
+public:
+    virtual ~IImageEncoder() {}
+
+    // 書き込みを開始する (対応していない形式なら例外を投げる)
+    virtual void Begin(std::ostream& stream, const ImageInfo& info) = 0;
+
+    // 続きの numRows 行を書き込む
+    virtual void WriteRows(const RGB* pixels, int numRows, const unsigned char* alpha = nullptr) = 0;
+
+    // 書き込みを終了する
+    virtual void End() = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// コーデック (画像形式ごとに1つ用意して ImageCodecs に登録する)
+//------------------------------------------------------------------------------
+class IImageCodec {
+public:
+    virtual ~IImageCodec() {}
+
+    // 形式名と拡張子 (".bmp" など)
+    virtual const char* Name() const = 0;
+    virtual const char* Extension() const = 0;
+
+    // ファイルの先頭 size byte から自身の形式か判定する
+    virtual bool Sniff(const unsigned char* head, int size) const = 0;
+
+    // デコーダ・エンコーダを生成する
+    virtual std::unique_ptr<IImageDecoder> CreateDecoder() const = 0;
+    virtual std::unique_ptr<IImageEncoder> CreateEncoder() const = 0;
+};
+
+
+//------------------------------------------------------------------------------
+// コーデックの登録と検索
+//------------------------------------------------------------------------------
+class ImageCodecs {
+public:
+    // Sniff に渡すファイル先頭の大きさ
+    static const int SniffSize = 16;
+
+    // コーデックを登録する (codec は登録後も破棄しないこと)
+    static void Register(const IImageCodec* codec);
+
+    // ファイルの先頭からコーデックを探す (見つからなければ nullptr)
+    static const IImageCodec* Find(const unsigned char* head, int size);
+
+    // stream の先頭を読んでコーデックを探す (読んだ位置は元に戻す)
+    static const IImageCodec* Find(std::istream& stream);
+
+    // ファイル名の拡張子からコーデックを探す (見つからなければ nullptr)
+    static const IImageCodec* FindByExtension(const char* fileName);
+
+    // ヘッダだけを読み込んで画像の情報を返す (画素は読まない)
+    static ImageInfo Probe(const char* fileName);
+};
+
+}
+
+#endif
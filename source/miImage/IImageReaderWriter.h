@@ -3,6 +3,15 @@
 
 namespace mi {
     class Image;
+
+    // ヘッダだけから分かる画像の情報
+    struct ImageInfo {
+        int  bit         = 0;     // bit数
+        int  width       = 0;     // 幅
+        int  height      = 0;     // 高さ (常に正の数)
+        int  compression = 0;     // 圧縮形式
+        bool topDown     = false; // 上の行から格納されているか
+    };
 }
 
 class IImageReaderWriter {
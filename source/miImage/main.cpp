@@ -1,21 +1,761 @@
+//==============================================================================
+//
+// miImage コマンドラインツール
+//
+//   ディレクトリやファイルリストで指定した Bitmap にフィルタチェインを適用し
+//   ファイル単位で並列に処理する
+//
+//==============================================================================
 #include "miImage.h"
+#include "miBitmap.h"
+#include "miFilterChain.h"
 #include "miImageProcessing.h"
-#include "miDepthProcessing.h"
+#include "miImageExpression.h"
+#include "miConvolution.h"
+#include "miKernels.h"
 
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
+#include <cerrno>
+#include <map>
+#include <exception>
+#include <type_traits>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace {
+
+//------------------------------------------------------------------------------
+// 処理結果
+//------------------------------------------------------------------------------
+struct Result {
+    bool   succeeded = false;
+    int    width     = 0;
+    int    height    = 0;
+    long   fileSize  = 0;
+    double loadTime  = 0; // [ms]
+    double filterTime= 0; // [ms]
+    double saveTime  = 0; // [ms]
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double ElapsedMilliseconds(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+//------------------------------------------------------------------------------
+// 使い方を表示する
+//------------------------------------------------------------------------------
+void PrintUsage(const char* program) {
+    std::cout
+        << "usage: " << program << " [options] <file|directory>..." << std::endl
+        << "  -f <chain>  filter chain (e.g. mono,gauss:5:1.0,gamma:2.2)" << std::endl
+        << "  -o <dir>    output directory (required unless -p)" << std::endl
+        << "  -p          probe headers only and print size / memory estimate" << std::endl
+        << "  -l <file>   read input paths from a list file (one per line)" << std::endl
+        << "  -c <codec>  output compression: rle8 (8bit) or rle4 (4bit)" << std::endl
+        << "  -j <num>    number of files processed concurrently" << std::endl
+        << "              (default: hardware threads, bounds images held in memory)" << std::endl
+        << "  -m <MB>     memory budget for decoded images (default: 2048)" << std::endl
+        << "              (files wait until it fits, larger files are rejected)" << std::endl
+        << "  --selftest  check Gaussian FixedPoint (+-1 of Reference), image expressions" << std::endl
+        << "              and ConvolutionFilter with each border policy" << std::endl
+        << "filters:" << std::endl;
+    mi::FilterChain::PrintUsage();
+}
+
+//------------------------------------------------------------------------------
+// 拡張子が .bmp か
+//------------------------------------------------------------------------------
+bool IsBitmapFile(const std::string& path) {
+    if(path.size() < 4) return false;
+    std::string ext = path.substr(path.size()-4);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == ".bmp";
+}
+
+//------------------------------------------------------------------------------
+// 入力パスを展開する (ディレクトリなら直下の .bmp を名前順に列挙する)
+//------------------------------------------------------------------------------
+void CollectInputs(const std::string& path, std::vector<std::string>& inputs) {
+
+    struct stat status;
+    if(stat(path.c_str(), &status) != 0) {
+        std::cerr<<"Error: Not Found \""<<path<<"\""<<std::endl;
+        return;
+    }
+
+    if(!S_ISDIR(status.st_mode)) {
+        inputs.push_back(path);
+        return;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if(dir == nullptr) {
+        std::cerr<<"Error: Cant Open Directory \""<<path<<"\""<<std::endl;
+        return;
+    }
+
+    std::vector<std::string> files;
+    while(dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if(IsBitmapFile(name)) {
+            files.push_back(path + "/" + name);
+        }
+    }
+    closedir(dir);
+
+    std::sort(files.begin(), files.end());
+    inputs.insert(inputs.end(), files.begin(), files.end());
+}
+
+//------------------------------------------------------------------------------
+// 出力パスを生成する (出力ディレクトリ + 入力ファイル名)
+//------------------------------------------------------------------------------
+std::string OutputPath(const std::string& outputDir, const std::string& input) {
+    std::string::size_type slash = input.find_last_of("/\\");
+    std::string name = (slash == std::string::npos) ? input : input.substr(slash+1);
+    return outputDir + "/" + name;
+}
+
+//------------------------------------------------------------------------------
+// 出力パスを生成する (同じ出力パスになる入力があれば表示して false を返す)
+//
+// MEMO:
+// 出力パスは入力のファイル名だけで決まるので、別のディレクトリの同名のファイルや
+// 同じファイルを2回指定すると出力が上書きされる (並列に処理すると同じファイルに
+// 同時に書き込む) ため、ワーカーを起動する前に弾く
+//------------------------------------------------------------------------------
+bool MakeOutputPaths(const std::string& outputDir, const std::vector<std::string>& inputs,
+                     std::vector<std::string>& outputs) {
+
+    outputs.resize(inputs.size());
+    std::map<std::string, size_t> first; // 出力パス -> 最初の入力の番号
+    bool unique = true;
+
+    for(size_t i=0; i<inputs.size(); i++) {
+        outputs[i] = OutputPath(outputDir, inputs[i]);
+        auto found = first.insert(std::make_pair(outputs[i], i));
+        if(!found.second) {
+            std::cerr<<"Error: Same Output \""<<outputs[i]<<"\" For \""
+                     <<inputs[found.first->second]<<"\" And \""<<inputs[i]<<"\""<<std::endl;
+            unique = false;
+        }
+    }
+
+    return unique;
+}
+
+//------------------------------------------------------------------------------
+// 展開した画像の合計の大きさを予算内に抑える
+//
+// MEMO:
+// -j は同時に処理するファイルの数を抑えるだけで、1枚の大きさは抑えられないので
+// ヘッダから分かる展開後の大きさを読み込む前に予約し、空きが足りなければ他の
+// ファイルの処理が終わるまで待つ (1枚で予算を超える画像は読み込まずにエラーにする)
+//------------------------------------------------------------------------------
+class MemoryBudget {
+
+public:
+    explicit MemoryBudget(size_t limit) : _limit(limit), _used(0) {}
+
+    size_t Limit() const { return _limit; }
+
+    // 予約する (予算を超える大きさなら例外を投げる)
+    void Acquire(size_t bytes) {
+        if(bytes > _limit) {
+            std::cerr<<"Error: Image Exceeds Memory Budget ("<<bytes/1e6<<" MB > "<<_limit/1e6<<" MB)"<<std::endl;
+            throw "Image Too Large";
+        }
+        std::unique_lock<std::mutex> lock(_mutex);
+        _released.wait(lock, [&]() { return _used + bytes <= _limit; });
+        _used += bytes;
+    }
+
+    // 予約を返す
+    void Release(size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _used -= bytes;
+        }
+        _released.notify_all();
+    }
+
+private:
+    std::mutex              _mutex;
+    std::condition_variable _released;
+    size_t                  _limit;
+    size_t                  _used;
+};
+
+// スコープを抜けるときに予約を返す
+class MemoryReservation {
+
+public:
+    MemoryReservation(MemoryBudget& budget, size_t bytes) : _budget(budget), _bytes(bytes) {
+        _budget.Acquire(_bytes);
+    }
+    ~MemoryReservation() {
+        _budget.Release(_bytes);
+    }
+
+private:
+    MemoryReservation(const MemoryReservation&);
+    MemoryReservation& operator=(const MemoryReservation&);
+
+    MemoryBudget& _budget;
+    size_t        _bytes;
+};
+
+//------------------------------------------------------------------------------
+// Image として展開したときの画素データの大きさ
+//------------------------------------------------------------------------------
+size_t DecodedBytes(const mi::ImageInfo& info) {
+    return (size_t)info.width * (size_t)info.height * sizeof(mi::RGB);
+}
+
+//------------------------------------------------------------------------------
+// 1ファイル処理する
+//------------------------------------------------------------------------------
+Result ProcessFile(const std::string& input, const std::string& output,
+                   const mi::FilterChain& chain, int compression, MemoryBudget& budget) {
+    Result result;
+
+    try {
+        // ヘッダで大きさを確かめてから読み込む
+        MemoryReservation reservation(budget, DecodedBytes(mi::Bitmap::Probe(input.c_str())));
+
+        auto start = Clock::now();
+        mi::Image image(input.c_str());
+        result.loadTime = ElapsedMilliseconds(start);
+
+        start = Clock::now();
+        chain.Process(image);
+        result.filterTime = ElapsedMilliseconds(start);
+
+        start = Clock::now();
+        if(compression == mi::Bitmap::BI_RLE8) {
+            image.Save(output.c_str(), 8, compression);
+        }
+        else if(compression == mi::Bitmap::BI_RLE4) {
+            image.Save(output.c_str(), 4, compression);
+        }
+        else {
+            image.Save(output.c_str());
+        }
+        result.saveTime = ElapsedMilliseconds(start);
+
+        struct stat status;
+        if(stat(input.c_str(), &status) == 0) {
+            result.fileSize = (long)status.st_size;
+        }
+
+        result.width     = image.Width();
+        result.height    = image.Height();
+        result.succeeded = true;
+    }
+    catch(const char* error) {
+        std::cerr<<"Error: "<<error<<" \""<<input<<"\""<<std::endl;
+    }
+    catch(const std::exception& error) {
+        std::cerr<<"Error: "<<error.what()<<" \""<<input<<"\""<<std::endl;
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+// ヘッダだけを読んで大きさと必要なメモリ量を表示する
+//------------------------------------------------------------------------------
+int ProbeFiles(const std::vector<std::string>& inputs, size_t budget) {
+
+    int    succeeded = 0;
+    double megaPixels= 0;
+    size_t maxBytes  = 0;
+
+    for(const auto& input : inputs) {
+        try {
+            mi::ImageInfo info = mi::Bitmap::Probe(input.c_str());
+
+            size_t bytes = DecodedBytes(info);
+
+            printf("%s: %dx%d %dbit compression %d (%.2f MB decoded%s)\n",
+                   input.c_str(), info.width, info.height, info.bit,
+                   info.compression, bytes / 1e6,
+                   bytes > budget ? ", exceeds memory budget" : "");
+
+            if(bytes > budget) continue;
+
+            succeeded++;
+            megaPixels += (double)info.width * info.height / 1e6;
+            maxBytes    = std::max(maxBytes, bytes);
+        }
+        catch(const char* error) {
+            std::cerr<<"Error: "<<error<<" \""<<input<<"\""<<std::endl;
+        }
+        catch(const std::exception& error) {
+            std::cerr<<"Error: "<<error.what()<<" \""<<input<<"\""<<std::endl;
+        }
+    }
+
+    printf("total: %d/%d files, %.2f MP, largest %.2f MB decoded\n",
+           succeeded, (int)inputs.size(), megaPixels, maxBytes / 1e6);
+
+    return succeeded == (int)inputs.size() ? 0 : 1;
+}
+
+//------------------------------------------------------------------------------
+// 自己診断用の乱数の画像
+//------------------------------------------------------------------------------
+mi::Image RandomImage(int width, int height) {
+    mi::Image image(24, width, height);
+    unsigned char* data = (unsigned char*)image.data;
+    for(int i=0; i<image.Size()*3; i++) {
+        data[i] = (unsigned char)(rand() & 0xff);
+    }
+    return image;
+}
+
+//------------------------------------------------------------------------------
+// 自己診断: マスクの幅, sigma, 画像の形を変えて Gaussian フィルタの FixedPoint を
+// Reference と比べ、差が 1 を超えたら失敗とする
+//------------------------------------------------------------------------------
+void SelfTestGaussian(int& tested, int& failed) {
+
+    const int    sizes[]     = { 1, 3, 5, 9, 15, 31, 61 };
+    const double sigmas[]    = { 0.5, 1.0, 2.0, 8.0, 50.0 };
+    const int    shapes[][2] = { {1,1}, {1,13}, {13,1}, {2,3}, {7,5}, {33,19}, {101,67} };
+
+    for(const auto& shape : shapes) {
+        mi::Image image = RandomImage(shape[0], shape[1]);
+
+        for(int size : sizes) {
+            for(double sigma : sigmas) {
+                mi::Image fixed = image;
+                mi::GaussianFilter(fixed, size, sigma, mi::GaussianFilter::FixedPoint);
+
+                mi::Image reference = image;
+                mi::GaussianFilter(reference, size, sigma, mi::GaussianFilter::Reference);
+
+                const unsigned char* a = (const unsigned char*)fixed.data;
+                const unsigned char* b = (const unsigned char*)reference.data;
+                int maxDiff = 0;
+                for(int i=0; i<image.Size()*3; i++) {
+                    maxDiff = std::max(maxDiff, std::abs(a[i] - b[i]));
+                }
+
+                tested++;
+                if(maxDiff > 1) {
+                    failed++;
+                    std::cerr<<"Error: Gaussian FixedPoint "<<shape[0]<<"x"<<shape[1]
+                             <<" size "<<size<<" sigma "<<sigma<<" differs by "<<maxDiff<<std::endl;
+                }
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// 自己診断: 画像の式を画素ごとの float の計算と比べる
+// (SIMD の部分と端数の部分の両方を通るように幅を 16 の倍数からずらす)
+// 大きさの違う画像を含む式の代入は例外になることも確かめる
+//------------------------------------------------------------------------------
+void SelfTestExpression(int& tested, int& failed) {
+
+    const int shapes[][2] = { {1,1}, {5,3}, {37,23} };
+
+    for(const auto& shape : shapes) {
+        mi::Image a = RandomImage(shape[0], shape[1]);
+        mi::Image b = RandomImage(shape[0], shape[1]);
+        mi::Image c = RandomImage(shape[0], shape[1]);
+
+        // 混合と、両側に飽和する式
+        mi::Image blend;
+        blend = a * 0.3 + b * 0.7 - c;
+        mi::Image scaled;
+        scaled = (a - 100) * 2;
+
+        const unsigned char* pa = (const unsigned char*)a.data;
+        const unsigned char* pb = (const unsigned char*)b.data;
+        const unsigned char* pc = (const unsigned char*)c.data;
+        const unsigned char* results[2] = { (const unsigned char*)blend.data, (const unsigned char*)scaled.data };
+
+        for(int k=0; k<2; k++) {
+            bool matched = (k == 0 ? blend : scaled).Width() == shape[0] &&
+                           (k == 0 ? blend : scaled).Height() == shape[1];
+            for(int i=0; matched && i<a.Size()*3; i++) {
+                float value = (k == 0) ? pa[i] * 0.3f + pb[i] * 0.7f - pc[i]
+                                       : (pa[i] - 100.0f) * 2.0f;
+                value = std::min(255.0f, std::max(0.0f, value));
+                matched = (results[k][i] == (unsigned char)(value + 0.5f));
+            }
+
+            tested++;
+            if(!matched) {
+                failed++;
+                std::cerr<<"Error: Image Expression "<<k<<" "<<shape[0]<<"x"<<shape[1]
+                         <<" differs from the scalar result"<<std::endl;
+            }
+        }
+    }
+
+    // 大きさの違う画像を含む式は例外を投げる
+    mi::Image a = RandomImage(7, 5);
+    mi::Image b = RandomImage(5, 7);
+    mi::Image out;
+    bool thrown = false;
+    std::streambuf* errorOutput = std::cerr.rdbuf(nullptr); // 想定しているエラー表示は出さない
+    try {
+        out = a + b;
+    }
+    catch(const char*) {
+        thrown = true;
+    }
+    std::cerr.rdbuf(errorOutput);
+
+    tested++;
+    if(!thrown) {
+        failed++;
+        std::cerr<<"Error: Image Expression With Different Sizes Did Not Throw"<<std::endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+// 自己診断用: 画素ごとに全タップを足し合わせる畳み込み
+// (ConvolutionFilter と同じく、整数の重みで Renormalize 以外なら飽和だけ、
+//  それ以外は四捨五入して 0..255 に収める)
+//------------------------------------------------------------------------------
+int MapBorder(mi::BorderPolicy border, int i, int n) {
+    switch(border) {
+    case mi::BorderPolicy::Clamp:  return mi::MapCoordinate<mi::BorderPolicy::Clamp>(i, n);
+    case mi::BorderPolicy::Mirror: return mi::MapCoordinate<mi::BorderPolicy::Mirror>(i, n);
+    default:                       return mi::MapCoordinate<mi::BorderPolicy::Zero>(i, n);
+    }
+}
+
+template<class K>
+mi::Image NaiveConvolution(const mi::Image& image, const K& kernel, mi::BorderPolicy border) {
+
+    const bool integral = std::is_integral<typename K::Weight>::value;
+    const int width  = image.Width();
+    const int height = image.Height();
+    const int kw = kernel.Width();
+    const int kh = kernel.Height();
+
+    mi::Image result = image;
+    const unsigned char* src = (const unsigned char*)image.data;
+    unsigned char*       dst = (unsigned char*)result.data;
+
+    for(int iY=0; iY<height; iY++) {
+        for(int iX=0; iX<width; iX++) {
+            for(int c=0; c<3; c++) {
+                double sum  = 0;
+                double norm = 0;
+                for(int j=0; j<kh; j++) {
+                    int y = MapBorder(border, iY+j-kh/2, height);
+                    for(int i=0; i<kw; i++) {
+                        int x = MapBorder(border, iX+i-kw/2, width);
+                        if(x < 0 || y < 0) continue;
+                        double weight = kernel.Data()[j*kw+i];
+                        sum  += weight * src[(y*width+x)*3+c];
+                        norm += weight;
+                    }
+                }
+                unsigned char& out = dst[(iY*width+iX)*3+c];
+                if(border == mi::BorderPolicy::Renormalize) {
+                    out = (unsigned char)std::min(255.0, std::max(0.0, sum * (1.0 / norm) + 0.5));
+                }
+                else if(integral) {
+                    out = (unsigned char)std::min(255, std::max(0, (int)sum));
+                }
+                else {
+                    out = (unsigned char)std::min(255.0, std::max(0.0, sum + 0.5));
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+//------------------------------------------------------------------------------
+// 自己診断: ConvolutionFilter を境界の扱いごとに画素ごとの畳み込みと比べる
+// (重みは 2 のべきの分数にして、積和の順序によらず double で誤差が出ないようにする)
+// 分離可能なカーネルは 1xN と Nx1 のカーネルを順に適用して確かめる
+//------------------------------------------------------------------------------
+void SelfTestConvolution(int& tested, int& failed) {
+
+    const mi::BorderPolicy borders[] = {
+        mi::BorderPolicy::Clamp, mi::BorderPolicy::Mirror,
+        mi::BorderPolicy::Zero,  mi::BorderPolicy::Renormalize };
+    const char* borderNames[] = { "Clamp", "Mirror", "Zero", "Renormalize" };
+    const int shapes[][2] = { {1,1}, {2,3}, {7,5}, {40,9}, {400,6} };
+
+    // 整数の重み (鮮鋭化)
+    const mi::Kernel<int, 3, 3> sharpen = {{
+         0, -1,  0,
+        -1,  5, -1,
+         0, -1,  0 }};
+
+    // 非対称な浮動小数点数の重み
+    mi::DynamicKernel<double> skewed(5, 3);
+    for(int i=0; i<5*3; i++) {
+        skewed[i] = (i + 1) / 128.0;
+    }
+
+    // 分離可能なカーネル (二項係数)
+    const double binomial[7] = { 1/64.0, 6/64.0, 15/64.0, 20/64.0, 15/64.0, 6/64.0, 1/64.0 };
+    mi::DynamicKernel<double> horizontal(7, 1);
+    mi::DynamicKernel<double> vertical(1, 7);
+    for(int i=0; i<7; i++) {
+        horizontal[i] = binomial[i];
+        vertical[i]   = binomial[i];
+    }
+
+    for(int b=0; b<4; b++) {
+        mi::BorderPolicy border = borders[b];
+        bool matched[3] = { true, true, true };
+
+        for(const auto& shape : shapes) {
+            mi::Image image = RandomImage(shape[0], shape[1]);
+            mi::Image results[3]  = { image, image, image };
+            mi::Image expected[3];
+
+            mi::ConvolutionFilter::Process(results[0], sharpen, border);
+            expected[0] = NaiveConvolution(image, sharpen, border);
+
+            mi::ConvolutionFilter::Process(results[1], skewed, border);
+            expected[1] = NaiveConvolution(image, skewed, border);
+
+            mi::ConvolutionFilter::Process(results[2], horizontal, border);
+            mi::ConvolutionFilter::Process(results[2], vertical, border);
+            expected[2] = NaiveConvolution(NaiveConvolution(image, horizontal, border), vertical, border);
+
+            for(int k=0; k<3; k++) {
+                matched[k] = matched[k] &&
+                    std::equal((const unsigned char*)results[k].data,
+                               (const unsigned char*)results[k].data + image.Size()*3,
+                               (const unsigned char*)expected[k].data);
+            }
+        }
+
+        const char* kernelNames[] = { "3x3 int", "5x3 double", "7x1 + 1x7 double" };
+        for(int k=0; k<3; k++) {
+            tested++;
+            if(!matched[k]) {
+                failed++;
+                std::cerr<<"Error: ConvolutionFilter "<<borderNames[b]<<" "<<kernelNames[k]
+                         <<" differs from the per-pixel convolution"<<std::endl;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// 自己診断 (失敗した項目を表示して、全て通れば 0 を返す)
+//------------------------------------------------------------------------------
+int SelfTest() {
+
+    int tested = 0;
+    int failed = 0;
+
+    srand(1);
+    SelfTestGaussian(tested, failed);
+    SelfTestExpression(tested, failed);
+    SelfTestConvolution(tested, failed);
+
+    printf("selftest (%s): %d/%d passed\n", mi::CurrentKernels().name, tested-failed, tested);
+
+    return failed == 0 ? 0 : 1;
+}
+
+}
+
+//------------------------------------------------------------------------------
+// エントリポイント
+//------------------------------------------------------------------------------
 int main(int argc, char* argv[]) {
 
-    int arr[10] = {1,2,3,4,5,6,7,8,9,10};
-    int ary[10] = {0};
+    std::string chainSpec;
+    std::string outputDir;
+    std::vector<std::string> inputs;
+    bool probeOnly = false;
+    int compression = mi::Bitmap::BI_RGB;
+    int numJobs = std::max(1u, std::thread::hardware_concurrency());
+    size_t budgetMegaBytes = 2048;
+
+    // 引数の解析
+    for(int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = (i+1 < argc);
+
+        if(arg == "-f" && hasValue) {
+            chainSpec = argv[++i];
+        }
+        else if(arg == "-o" && hasValue) {
+            outputDir = argv[++i];
+        }
+        else if(arg == "-j" && hasValue) {
+            numJobs = std::max(1, atoi(argv[++i]));
+        }
+        else if(arg == "-m" && hasValue) {
+            budgetMegaBytes = (size_t)std::max(1L, atol(argv[++i]));
+        }
+        else if(arg == "-l" && hasValue) {
+            std::ifstream list(argv[++i]);
+            if(!list.is_open()) {
+                std::cerr<<"Error: Cant File Open \""<<argv[i]<<"\""<<std::endl;
+                return 1;
+            }
+            std::string line;
+            while(std::getline(list, line)) {
+                if(!line.empty() && line[line.size()-1] == '\r') line.erase(line.size()-1);
+                if(!line.empty()) CollectInputs(line, inputs);
+            }
+        }
+        else if(arg == "-c" && hasValue) {
+            std::string codec = argv[++i];
+            if(codec == "rle8") {
+                compression = mi::Bitmap::BI_RLE8;
+            }
+            else if(codec == "rle4") {
+                compression = mi::Bitmap::BI_RLE4;
+            }
+            else {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if(arg == "-p") {
+            probeOnly = true;
+        }
+        else if(arg == "--selftest") {
+            return SelfTest();
+        }
+        else if(arg == "-h" || arg == "--help") {
+            PrintUsage(argv[0]);
+            return 0;
+        }
+        else if(arg[0] == '-') {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        else {
+            CollectInputs(arg, inputs);
+        }
+    }
+
+    size_t budgetBytes = budgetMegaBytes * 1000000;
+
+    if(probeOnly && !inputs.empty()) {
+        return ProbeFiles(inputs, budgetBytes);
+    }
+
+    if(outputDir.empty() || inputs.empty()) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // フィルタチェインの生成
+    mi::FilterChain* chain = nullptr;
+    try {
+        chain = new mi::FilterChain(chainSpec.c_str());
+    }
+    catch(const char* error) {
+        std::cerr<<"Error: "<<error<<std::endl;
+        return 1;
+    }
+
+    // 出力パス
+    std::vector<std::string> outputs;
+    if(!MakeOutputPaths(outputDir, inputs, outputs)) {
+        delete chain;
+        return 1;
+    }
+
+    // 出力先の作成 (既にあるディレクトリはそのまま使う)
+    if(mkdir(outputDir.c_str(), 0755) != 0) {
+        int error = errno;
+        struct stat status;
+        if(error != EEXIST || stat(outputDir.c_str(), &status) != 0 || !S_ISDIR(status.st_mode)) {
+            std::cerr<<"Error: Cant Create Directory \""<<outputDir<<"\" ("
+                     <<strerror(error != EEXIST ? error : ENOTDIR)<<")"<<std::endl;
+            delete chain;
+            return 1;
+        }
+    }
+
+    // 各ワーカーが次のファイルを取り出して処理する
+    // 同時に読み込む画像は numJobs 枚まで、展開後の合計は budget までに抑えられる
+    std::vector<Result> results(inputs.size());
+    MemoryBudget budget(budgetBytes);
+    std::atomic<int> next(0);
+    std::mutex printMutex;
+
+    auto worker = [&]() {
+        for(int i=next++; i<(int)inputs.size(); i=next++) {
+
+            results[i] = ProcessFile(inputs[i], outputs[i], *chain, compression, budget);
 
-    std::copy(&arr[5],&arr[5]+5, ary);
+            const Result& r = results[i];
+            if(!r.succeeded) continue;
 
+            double total = r.loadTime + r.filterTime + r.saveTime;
+            double megaPixels = (double)r.width * r.height / 1e6;
 
-    for(int i=0; i<10; i++)
-    {
-        std::cout<<ary[i]<<" "<<arr[i]<<std::endl;
+            std::lock_guard<std::mutex> lock(printMutex);
+            printf("%s: %dx%d load %.1fms filter %.1fms save %.1fms (%.2f MP/s)\n",
+                   inputs[i].c_str(), r.width, r.height,
+                   r.loadTime, r.filterTime, r.saveTime,
+                   total > 0 ? megaPixels / (total / 1000.0) : 0.0);
+        }
+    };
+
+    auto start = Clock::now();
+
+    numJobs = std::min(numJobs, (int)inputs.size());
+    std::vector<std::thread> threads;
+    for(int i=0; i<numJobs; i++) {
+        threads.push_back(std::thread(worker));
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    double wallTime = ElapsedMilliseconds(start);
+
+    // 集計
+    int    succeeded  = 0;
+    double megaPixels = 0;
+    double megaBytes  = 0;
+    for(const auto& r : results) {
+        if(!r.succeeded) continue;
+        succeeded++;
+        megaPixels += (double)r.width * r.height / 1e6;
+        megaBytes  += r.fileSize / 1e6;
     }
 
-    return 0;
-}
\ No newline at end of file
+    printf("total: %d/%d files, %.2f MP in %.1fms (%.2f MP/s, %.2f MB/s, %d jobs)\n",
+           succeeded, (int)inputs.size(), megaPixels, wallTime,
+           wallTime > 0 ? megaPixels / (wallTime / 1000.0) : 0.0,
+           wallTime > 0 ? megaBytes  / (wallTime / 1000.0) : 0.0,
+           numJobs);
+
+    delete chain;
+
+    return succeeded == (int)inputs.size() ? 0 : 1;
+}
@@ -6,18 +6,30 @@
 #ifndef _MI_BITMAP_H_
 #define _MI_BITMAP_H_
 
-#include <fstream>
 #include "miImage.h"
 #include "IImageReaderWriter.h"
+#include "miBitmapCodec.h"
 
 namespace mi {
 
 //------------------------------------------------------------------------------
-// Windows Bitmap を読み書きするクラス (8,24,32bitのみ)
+// Windows Bitmap を読み書きするクラス (4,8,24,32bitのみ, 4,8bitはRLE圧縮にも対応)
+//
+// MEMO:
+// 画像全体を自身の画素データとして保持する。読み書きは BitmapDecoder,
+// BitmapEncoder でおこなうので、Image へ直接読み書きする場合はそちらを使う
 //------------------------------------------------------------------------------
 class Bitmap : public IImageReaderWriter {
 public:
 
+    // 圧縮形式 (biCompression の値)
+    enum {
+        BI_RGB       = BitmapCodec::BI_RGB,
+        BI_RLE8      = BitmapCodec::BI_RLE8,
+        BI_RLE4      = BitmapCodec::BI_RLE4,
+        BI_BITFIELDS = BitmapCodec::BI_BITFIELDS,
+    };
+
     //--------------------------------------------------------------------------
     // コンストラクタ
     //--------------------------------------------------------------------------
@@ -30,10 +42,19 @@ public:
     //--------------------------------------------------------------------------
     // Getter
     //--------------------------------------------------------------------------
-    int Bit()   { return _header.bitmapInfoHeader.biBitCount; }
-    int Width() { return _header.bitmapInfoHeader.biWidth; }
-    int Height(){ return _header.bitmapInfoHeader.biHeight; }
+    int Bit()   { return _info.bit; }
+    int Width() { return _info.width; }
+    int Height(){ return _info.height; }
     int Size()  { return Width() * Height(); }
+    int Compression() { return _info.compression; }
+
+
+    //--------------------------------------------------------------------------
+    // Setter
+    //--------------------------------------------------------------------------
+
+    // 書き込むときの圧縮形式 (BI_RLE8 は 8bit, BI_RLE4 は 4bit のときのみ)
+    void SetCompression(int compression) { _info.compression = compression; }
 
 
     //--------------------------------------------------------------------------
@@ -42,6 +63,9 @@ public:
     void Read(const char* fileName);
     void Write(const char* fileName);
 
+    // ヘッダだけを読み込んで検証する (画素データは読まない)
+    static ImageInfo Probe(const char* fileName);
+
 
     //--------------------------------------------------------------------------
     // IImageReaderWriter
@@ -53,30 +77,6 @@ private:
     // 使えないようにする
     Bitmap(){};
 
-    // BitmapFileHeader (Bitmapファイル共通のヘッダ情報)
-    struct BITMAPFILEHEADER {
-        unsigned short bfType      = ('B'|('M'<<8));
-        unsigned int   bfSize      = 54;
-        unsigned short bfReserved1 = 0;
-        unsigned short bfReserved2 = 0;
-        unsigned int   bfOffBits   = 54;
-    };
-
-    // BitmapInfoHeader (Windows Bitmapのヘッダ情報)
-    struct BITMAPINFOHEADER{
-        unsigned int   biSize         = 0;
-        int            biWidth        = 0;
-        int            biHeight       = 0;
-        unsigned short biPlanes       = 1;
-        unsigned short biBitCount     = 24;
-        unsigned int   biCompression  = 0;
-        unsigned int   biSizeImage    = 0;
-        int            biXPixPerMeter = 3780;
-        int            biYPixPerMeter = 3780;
-        unsigned int   biClrUsed      = 0;
-        unsigned int   biClrImportant = 0;
-    };
-
     // ピクセル型
     struct RGBQUAD {
         unsigned char b = 0;
@@ -85,40 +85,17 @@ private:
         unsigned char reserved = 0;
     };
 
-    // Bitmap Header をまとめた型
-    struct WindowsBitmapHeader {
-        BITMAPFILEHEADER bitmapFileHeader;
-        BITMAPINFOHEADER bitmapInfoHeader;
-    };
+    // 画像の情報
+    ImageInfo _info;
 
-    // Bitmap Header
-    WindowsBitmapHeader _header;
+    // パレットデータ (グレースケール以外のパレットを読み込んだときだけ書き込みに使う)
+    RGB  _palette[256];
+    bool _hasPalette = false;
 
-    // パレットデータ
-    RGBQUAD _palette[256];
-    
     // 画素データ
     RGBQUAD* _pixels = nullptr;
-
-    //--------------------------------------------------------------------------
-    // WindowsBitmapheader の読み込み・書き込み
-    //--------------------------------------------------------------------------
-    void ReadWindowsBitmapHeader(std::ifstream& file);
-    void WriteWindowsBitmapHeader(std::ofstream& file);
-    
-    //--------------------------------------------------------------------------
-    // BitmapPalette の読み込み・書き込み
-    //--------------------------------------------------------------------------
-    void ReadBitmapPalette(std::ifstream& file);
-    void WriteBitmapPalette(std::ofstream& file);
-
-    //--------------------------------------------------------------------------
-    // WindowsBitmap 画像の読み込み・書き込み
-    //--------------------------------------------------------------------------
-    void ReadBitmapImage(std::ifstream& file);
-    void WriteBitmapImage(std::ofstream& file);
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,766 @@
+//==============================================================================
+//
+// Windows Bitmap のコーデック
+//
+//==============================================================================
+#include "miBitmapCodec.h"
+#include "miKernels.h"
+
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// p から始まる同じ値の連続数を数える (最大 maxLength)
+//
+//   MEMO: 8byteずつまとめて比較してから残りを1byteずつ比較する
+//------------------------------------------------------------------------------
+int RunLength(const unsigned char* p, int maxLength) {
+
+    const unsigned long long pattern = 0x0101010101010101ULL * p[0];
+
+    int length = 1;
+    while(length + 8 <= maxLength) {
+        unsigned long long block;
+        memcpy(&block, p + length, 8);
+        if(block != pattern) break;
+        length += 8;
+    }
+    while(length < maxLength && p[length] == p[0]) {
+        length++;
+    }
+    return length;
+}
+
+//------------------------------------------------------------------------------
+// p から始まる連続しない部分の長さを数える (3画素以上の連続が始まる手前まで)
+//------------------------------------------------------------------------------
+int LiteralLength(const unsigned char* p, int maxLength) {
+
+    int length = 0;
+    while(length < maxLength) {
+        if(length + 2 < maxLength && p[length] == p[length+1] && p[length] == p[length+2]) break;
+        length++;
+    }
+    return length;
+}
+
+}
+
+
+//------------------------------------------------------------------------------
+// デコーダ・エンコーダを生成する
+//------------------------------------------------------------------------------
+std::unique_ptr<IImageDecoder> BitmapCodec::CreateDecoder() const {
+    return std::unique_ptr<IImageDecoder>(new BitmapDecoder());
+}
+
+std::unique_ptr<IImageEncoder> BitmapCodec::CreateEncoder() const {
+    return std::unique_ptr<IImageEncoder>(new BitmapEncoder());
+}
+
+
+//==============================================================================
+// デコーダ
+//==============================================================================
+
+//------------------------------------------------------------------------------
+// ヘッダを読み込んで検証する
+//------------------------------------------------------------------------------
+ImageInfo BitmapDecoder::ReadHeader(std::istream& file) {
+
+    stream = &file;
+    indices.clear();
+
+    // ヘッダを読み込む
+    ReadWindowsBitmapHeader(file);
+    if(!file) {
+        std::cerr<<"Error: Broken Bitmap Header"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // 対応している形式かチェック
+    CheckWindowsBitmapHeader();
+
+    // パレットの読み込み
+    ReadBitmapPalette(file);
+
+    // 無圧縮の場合は全ての行がファイルに収まっているかチェック
+    // (RLE は展開しながら途中で終わった残りを 0 にする)
+    if(Compression() != BitmapCodec::BI_RLE8 && Compression() != BitmapCodec::BI_RLE4) {
+        std::streamoff current = file.tellg();
+        file.seekg(0, std::ios::end);
+        std::streamoff fileSize = file.tellg();
+        file.seekg(current);
+
+        std::streamoff dataEnd = header.bitmapFileHeader.bfOffBits + (std::streamoff)Stride() * abs(Height());
+        if(current < 0 || fileSize < dataEnd) {
+            std::cerr<<"Error: Broken Bitmap Image"<<std::endl;
+            throw "File Open Error";
+        }
+    }
+
+    ImageInfo info;
+    info.bit         = Bit();
+    info.width       = Width();
+    info.height      = abs(Height());
+    info.compression = Compression();
+    info.topDown     = Height() < 0;
+
+    return info;
+}
+
+//------------------------------------------------------------------------------
+// startRow 行目から numRows 行を展開する
+//------------------------------------------------------------------------------
+void BitmapDecoder::ReadRows(int startRow, int numRows, RGB* pixels, unsigned char* alpha) {
+
+    const int width = Width();
+    const int rows  = abs(Height());
+
+    if(stream == nullptr || startRow < 0 || numRows < 0 || startRow + numRows > rows) {
+        std::cerr<<"Error: Invalid Row Range"<<std::endl;
+        throw "File Read Error";
+    }
+
+    // RLE の場合は最初に全体をパレット番号へ展開しておく
+    if(Compression() == BitmapCodec::BI_RLE8 || Compression() == BitmapCodec::BI_RLE4) {
+
+        if(indices.empty()) {
+            stream->clear();
+            // RLE は下の行からしか格納できず行の長さも可変なので、上の行から
+            // 返すためにはファイルの残りを読んで全体を展開しておく必要がある
+            stream->seekg(header.bitmapFileHeader.bfOffBits);
+            std::vector<unsigned char> data((std::istreambuf_iterator<char>(*stream)),
+                                             std::istreambuf_iterator<char>());
+            indices.assign(width * rows, 0);
+            DecodeRLE(data);
+        }
+
+        const unsigned char* src = &indices[width * startRow];
+        for(int i=0; i<width*numRows; i++) {
+            pixels[i] = palette[src[i]];
+        }
+        if(alpha != nullptr) {
+            std::fill(alpha, alpha + width*numRows, 255);
+        }
+        return;
+    }
+
+    // 無圧縮の場合はファイル上で連続する順に1行ずつ読み込む
+    // (下の行から格納されている場合は最後の行から読む)
+    const int stride  = Stride();
+    const bool topDown= Height() < 0;
+    const int fileRow = topDown ? startRow : rows - (startRow + numRows);
+
+    line.resize(stride);
+    stream->clear();
+    stream->seekg(header.bitmapFileHeader.bfOffBits + (std::streamoff)fileRow * stride);
+
+    for(int i=0; i<numRows; i++) {
+
+        int iY = topDown ? i : numRows-1-i; // pixels 内の行
+
+        stream->read((char*)line.data(), stride);
+        if(!*stream) {
+            std::cerr<<"Error: Broken Bitmap Image"<<std::endl;
+            throw "File Open Error";
+        }
+
+        UnpackRow(line.data(), &pixels[width*iY], alpha ? &alpha[width*iY] : nullptr);
+    }
+}
+
+//------------------------------------------------------------------------------
+// パレット数 (4,8bit 以外は 0)
+//------------------------------------------------------------------------------
+int BitmapDecoder::NumPaletteColors() const {
+    return (Bit() <= 8) ? (1 << Bit()) : 0;
+}
+
+//------------------------------------------------------------------------------
+// ヘッダを読み込む
+//------------------------------------------------------------------------------
+void BitmapDecoder::ReadWindowsBitmapHeader(std::istream& file) {
+
+    // 各型のサイズや構造体のアラインを考慮して各項目の読み込みサイズを直接指定している
+
+    // BITMAPFILEHEADER
+    file.read((char*)&header.bitmapFileHeader.bfType,      2);
+    file.read((char*)&header.bitmapFileHeader.bfSize,      4);
+    file.read((char*)&header.bitmapFileHeader.bfReserved1, 2);
+    file.read((char*)&header.bitmapFileHeader.bfReserved2, 2);
+    file.read((char*)&header.bitmapFileHeader.bfOffBits,   4);
+
+    // BITMAPINFOHEADER
+    file.read((char*)&header.bitmapInfoHeader.biSize,         4);
+    file.read((char*)&header.bitmapInfoHeader.biWidth,        4);
+    file.read((char*)&header.bitmapInfoHeader.biHeight,       4);
+    file.read((char*)&header.bitmapInfoHeader.biPlanes,       2);
+    file.read((char*)&header.bitmapInfoHeader.biBitCount,     2);
+    file.read((char*)&header.bitmapInfoHeader.biCompression,  4);
+    file.read((char*)&header.bitmapInfoHeader.biSizeImage,    4);
+    file.read((char*)&header.bitmapInfoHeader.biXPixPerMeter, 4);
+    file.read((char*)&header.bitmapInfoHeader.biYPixPerMeter, 4);
+    file.read((char*)&header.bitmapInfoHeader.biClrUsed,      4);
+    file.read((char*)&header.bitmapInfoHeader.biClrImportant, 4);
+
+    // V4タイプ対応のための読み飛ばし
+    if(header.bitmapInfoHeader.biSize == 108) {
+        char dummy[36];
+        file.read(dummy, 4); // bV4RedMask
+        file.read(dummy, 4); // bV4GreenMask
+        file.read(dummy, 4); // bV4BlueMask
+        file.read(dummy, 4); // bV4AlphaMask
+
+        file.read(dummy, 4); // bV4CSType
+        file.read(dummy,36); // bV4Endpoints;
+
+        file.read(dummy, 4); // bV4GammaRed;
+        file.read(dummy, 4); // bV4GammaGreen;
+        file.read(dummy, 4); // bV4GammaBlue;
+    }
+
+    // V5タイプ対応のための読み飛ばし
+    if(header.bitmapInfoHeader.biSize == 124) {
+        char dummy[36];
+        file.read(dummy, 4); // bV5RedMask
+        file.read(dummy, 4); // bV5GreenMask
+        file.read(dummy, 4); // bV5BlueMask
+        file.read(dummy, 4); // bV5AlphaMask
+
+        file.read(dummy, 4); // bV5CSType
+        file.read(dummy,36); // bV5Endpoints;
+
+        file.read(dummy, 4); // bV5GammaRed;
+        file.read(dummy, 4); // bV5GammaGreen;
+        file.read(dummy, 4); // bV5GammaBlue;
+
+        file.read(dummy, 4); // bV5Intent;
+        file.read(dummy, 4); // bV5ProfileData;
+        file.read(dummy, 4); // bV5ProfileSize;
+        file.read(dummy, 4); // bV5Reserved;
+    }
+}
+
+//------------------------------------------------------------------------------
+// 読み込んだヘッダが対応している形式か確認する
+//------------------------------------------------------------------------------
+void BitmapDecoder::CheckWindowsBitmapHeader() {
+
+    // Bitmapファイルかチェック
+    if(header.bitmapFileHeader.bfType != ('B'|('M'<<8))){
+        std::cerr<<"Error: This is not Bitmap Image"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // Windows Bitmap がチェック (biSizeが40ならWindowsBitmap, 108,124はV4,V5)
+    if(header.bitmapInfoHeader.biSize != 40 &&
+       header.bitmapInfoHeader.biSize !=108 &&
+       header.bitmapInfoHeader.biSize !=124 ) {
+        std::cerr<<"Error: This is not Windows Bitmap"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // 4,8,24,32bitではない場合
+    if( Bit()!=4 && Bit()!=8 && Bit()!=24 && Bit()!=32 ) {
+        std::cerr<<"Error: Not Supported Bitmap"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // 対応していない圧縮形式の場合 (32bitの BI_BITFIELDS は BGRA として扱う)
+    auto compression = Compression();
+    if( compression!=BitmapCodec::BI_RGB &&
+        !(compression==BitmapCodec::BI_RLE8      && Bit()==8 ) &&
+        !(compression==BitmapCodec::BI_RLE4      && Bit()==4 ) &&
+        !(compression==BitmapCodec::BI_BITFIELDS && Bit()==32) ) {
+        std::cerr<<"Error: Not Supported Compression"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // 大きさが不正な場合 (RLE は下の行からしか格納できない)
+    bool isRLE = (compression==BitmapCodec::BI_RLE8 || compression==BitmapCodec::BI_RLE4);
+    if( Width()<=0 || Height()==0 || header.bitmapInfoHeader.biPlanes!=1 ||
+        (isRLE && Height()<0) ) {
+        std::cerr<<"Error: Invalid Bitmap Size"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // 大きすぎる場合 (展開した画素データや1行のデータの大きさが int に収まらない)
+    long long numPixels = (long long)Width() * llabs((long long)Height());
+    if( numPixels * (long long)sizeof(RGB) > INT_MAX ||
+        ((long long)Width() * Bit() + 31) / 32 * 4 > INT_MAX ) {
+        std::cerr<<"Error: Too Large Bitmap"<<std::endl;
+        throw "File Open Error";
+    }
+
+    // パレット数が不正な場合
+    if( Bit()<=8 && header.bitmapInfoHeader.biClrUsed > (1u<<Bit()) ) {
+        std::cerr<<"Error: Invalid Palette Size"<<std::endl;
+        throw "File Open Error";
+    }
+}
+
+//------------------------------------------------------------------------------
+// パレットを読み込む
+//------------------------------------------------------------------------------
+void BitmapDecoder::ReadBitmapPalette(std::istream& file) {
+
+    // 24,32bitのときはパレットが無いので読み込まない
+    // 4,8bitで biClrUsed=0 のときは 2^bit 色
+    int numColors = NumPaletteColors();
+    if(numColors > 0 && header.bitmapInfoHeader.biClrUsed > 0) {
+        numColors = header.bitmapInfoHeader.biClrUsed;
+    }
+
+    // ファイル上は RGBQUAD (B,G,R,予約) の並び
+    unsigned char quad[256*4];
+    file.read((char*)quad, numColors*4);
+
+    for(int i=0; i<256; i++) {
+        palette[i] = (i < numColors) ? RGB(quad[i*4+2], quad[i*4+1], quad[i*4+0]) : RGB();
+    }
+}
+
+//------------------------------------------------------------------------------
+// 1行分のファイル上のデータを画素に変換する
+//------------------------------------------------------------------------------
+void BitmapDecoder::UnpackRow(const unsigned char* src, RGB* pixels, unsigned char* alpha) {
+
+    const int width = Width();
+
+    switch(Bit()) {
+    case 32:
+        CurrentKernels().unpackBGRA(src, (unsigned char*)pixels, alpha, width);
+        return;
+    case 24:
+        CurrentKernels().swapRB(src, (unsigned char*)pixels, width);
+        break;
+    case 8:
+        for(int iX=0; iX<width; iX++) {
+            pixels[iX] = palette[src[iX]];
+        }
+        break;
+    case 4:
+        for(int iX=0; iX<width; iX++) {
+            int index = (iX & 1) ? (src[iX/2] & 0x0f) : (src[iX/2] >> 4);
+            pixels[iX] = palette[index];
+        }
+        break;
+    }
+
+    if(alpha != nullptr) {
+        std::fill(alpha, alpha + width, 255);
+    }
+}
+
+//------------------------------------------------------------------------------
+// RLE8, RLE4 を展開する
+//
+//   data : 圧縮された画素データ
+//
+//   MEMO: 移動 (delta) で飛ばされた画素や、途中で終わった場合の残りは 0 のまま
+//------------------------------------------------------------------------------
+void BitmapDecoder::DecodeRLE(const std::vector<unsigned char>& data) {
+
+    const int width  = Width();
+    const int height = Height();
+    const bool isRLE4 = (Compression() == BitmapCodec::BI_RLE4);
+
+    // 画素を書き込む (範囲外は無視する)
+    auto put = [&](int x, int y, int index) {
+        if(x < width && y < height) {
+            indices[width * (height-1-y) + x] = (unsigned char)index;
+        }
+    };
+
+    int x = 0, y = 0; // y は下の行から数える
+    size_t i = 0;
+
+    while(i + 1 < data.size() && y < height) {
+
+        int count = data[i++];
+        int value = data[i++];
+
+        // 連続モード: count 画素を value で埋める (RLE4 は上位と下位の4bitを交互に使う)
+        if(count > 0) {
+            for(int j=0; j<count; j++, x++) {
+                put(x, y, isRLE4 ? ((j & 1) ? (value & 0x0f) : (value >> 4)) : value);
+            }
+            continue;
+        }
+
+        // 行の終わり
+        if(value == 0) {
+            x = 0;
+            y++;
+        }
+        // 画像の終わり
+        else if(value == 1) {
+            break;
+        }
+        // 移動
+        else if(value == 2) {
+            if(i + 1 >= data.size()) break;
+            x += data[i++];
+            y += data[i++];
+        }
+        // 絶対モード: value 画素をそのまま読み込む (2byte境界に揃える)
+        else {
+            int bytes = isRLE4 ? (value + 1) / 2 : value;
+            if(i + bytes > data.size()) break;
+
+            for(int j=0; j<value; j++, x++) {
+                int index = isRLE4 ? ((j & 1) ? (data[i + j/2] & 0x0f) : (data[i + j/2] >> 4))
+                                   : data[i + j];
+                put(x, y, index);
+            }
+            i += bytes + (bytes & 1);
+        }
+    }
+}
+
+
+//==============================================================================
+// エンコーダ
+//==============================================================================
+
+//------------------------------------------------------------------------------
+// コンストラクタ (パレットはグレースケール)
+//------------------------------------------------------------------------------
+BitmapEncoder::BitmapEncoder() {
+    for(int i=0; i<256; i++) {
+        palette[i] = RGB(i, i, i);
+    }
+}
+
+//------------------------------------------------------------------------------
+// パレットを設定する
+//------------------------------------------------------------------------------
+void BitmapEncoder::SetPalette(const RGB* colors, int numColors) {
+    for(int i=0; i<256; i++) {
+        palette[i] = (i < numColors) ? colors[i] : RGB();
+    }
+    customPalette = true;
+}
+
+//------------------------------------------------------------------------------
+// 書き込みを開始する
+//------------------------------------------------------------------------------
+void BitmapEncoder::Begin(std::ostream& file, const ImageInfo& info) {
+
+    stream = &file;
+    row    = 0;
+    encodedRows.clear();
+
+    header.bitmapInfoHeader.biBitCount    = info.bit;
+    header.bitmapInfoHeader.biWidth       = info.width;
+    header.bitmapInfoHeader.biHeight      = info.height;
+    header.bitmapInfoHeader.biCompression = info.compression;
+
+    if(info.width <= 0 || info.height <= 0) {
+        std::cerr<<"Error: Invalid Bitmap Size"<<std::endl;
+        throw "File Write Error";
+    }
+
+    // 4,8,24,32bitではない場合
+    if( Bit()!=4 && Bit()!=8 && Bit()!=24 && Bit()!=32 ) {
+        std::cerr<<"Error: Not Supported Bitmap"<<std::endl;
+        throw "File Write Error";
+    }
+
+    // RLE は 8bit なら BI_RLE8, 4bit なら BI_RLE4 のみ (それ以外は無圧縮)
+    if( (Compression() == BitmapCodec::BI_RLE8 && Bit() != 8) ||
+        (Compression() == BitmapCodec::BI_RLE4 && Bit() != 4) ) {
+        std::cerr<<"Error: Compression Does Not Match Bit Count"<<std::endl;
+        throw "File Write Error";
+    }
+    // 無圧縮は上の行から格納する (biHeight を負にして順に書き込めるようにする)
+    // RLE は下の行からしか格納できないので End でまとめて書き込む
+    if(!IsRLE()) {
+        header.bitmapInfoHeader.biCompression = BitmapCodec::BI_RGB;
+        header.bitmapInfoHeader.biHeight      = -info.height;
+    }
+
+    // パレットがグレースケールなら輝度から直接パレット番号を求める
+    int numColors = NumPaletteColors();
+    grayscalePalette = true;
+    for(int i=0; i<numColors; i++) {
+        int level = i * 255 / (numColors-1);
+        if(!customPalette) {
+            palette[i] = RGB(level, level, level);
+        }
+        else if(palette[i].r != level || palette[i].g != level || palette[i].b != level) {
+            grayscalePalette = false;
+        }
+    }
+
+    line.assign(Stride(), 0);
+    indices.resize(Width());
+
+    // RLE は大きさが決まってからまとめて書き込む
+    if(!IsRLE()) {
+        WriteWindowsBitmapHeader(Stride() * Rows());
+    }
+}
+
+//------------------------------------------------------------------------------
+// 続きの numRows 行を書き込む
+//------------------------------------------------------------------------------
+void BitmapEncoder::WriteRows(const RGB* pixels, int numRows, const unsigned char* alpha) {
+
+    const int width = Width();
+
+    if(stream == nullptr || numRows < 0 || row + numRows > Rows()) {
+        std::cerr<<"Error: Invalid Row Range"<<std::endl;
+        throw "File Write Error";
+    }
+
+    for(int i=0; i<numRows; i++, row++) {
+
+        const RGB* src = &pixels[width*i];
+        const unsigned char* a = alpha ? &alpha[width*i] : nullptr;
+
+        // RLE は行ごとに圧縮しておく
+        if(IsRLE()) {
+            ToPaletteIndices(src, indices.data());
+            encodedRows.push_back(std::vector<unsigned char>());
+            EncodeRLE(indices.data(), encodedRows.back());
+            continue;
+        }
+
+        // 上の行から格納するので続けて書き込む
+        PackRow(src, a, line.data());
+        stream->write((const char*)line.data(), line.size());
+    }
+}
+
+//------------------------------------------------------------------------------
+// 書き込みを終了する
+//------------------------------------------------------------------------------
+void BitmapEncoder::End() {
+
+    if(stream == nullptr || row != Rows()) {
+        std::cerr<<"Error: Image Is Not Completed"<<std::endl;
+        throw "File Write Error";
+    }
+
+    if(IsRLE()) {
+
+        // 行の終わりと画像の終わりを含めた大きさ
+        size_t imageSize = 0;
+        for(const auto& encoded : encodedRows) {
+            imageSize += encoded.size() + 2;
+        }
+
+        WriteWindowsBitmapHeader((unsigned int)imageSize);
+
+        // 下の行から書き込む (最後の行は画像の終わり)
+        for(int iY=Rows()-1; iY>=0; iY--) {
+            const auto& encoded = encodedRows[iY];
+            const unsigned char end[2] = { 0, (unsigned char)(iY > 0 ? 0 : 1) };
+            stream->write((const char*)encoded.data(), encoded.size());
+            stream->write((const char*)end, 2);
+        }
+        encodedRows.clear();
+    }
+
+    stream->flush();
+    if(!*stream) {
+        std::cerr<<"Error: Cant File Write"<<std::endl;
+        throw "File Write Error";
+    }
+    stream = nullptr;
+}
+
+//------------------------------------------------------------------------------
+// ヘッダとパレットを書き込む
+//------------------------------------------------------------------------------
+void BitmapEncoder::WriteWindowsBitmapHeader(unsigned int imageSize) {
+
+    auto numColors = NumPaletteColors();   // パレット数
+    auto offset    = 54 + numColors * 4;   // 画素データの開始位置
+
+    // ヘッダに書き込む値を設定
+    header.bitmapFileHeader.bfType = 'B'|('M'<<8);
+    header.bitmapFileHeader.bfSize = offset + imageSize;
+    header.bitmapFileHeader.bfReserved1 = 0;
+    header.bitmapFileHeader.bfReserved2 = 0;
+    header.bitmapFileHeader.bfOffBits   = offset;
+
+    header.bitmapInfoHeader.biSize         = 40;
+    header.bitmapInfoHeader.biPlanes       = 1;
+    header.bitmapInfoHeader.biSizeImage    = imageSize;
+    header.bitmapInfoHeader.biXPixPerMeter = 3780;
+    header.bitmapInfoHeader.biYPixPerMeter = 3780;
+    header.bitmapInfoHeader.biClrUsed      = numColors;
+    header.bitmapInfoHeader.biClrImportant = 0;
+
+    std::ostream& file = *stream;
+
+    // 各型のサイズや構造体のアラインを考慮して各項目の書き込みサイズを直接指定している
+
+    // BITMAPFILEHEADER
+    file.write((char*)&header.bitmapFileHeader.bfType,      2);
+    file.write((char*)&header.bitmapFileHeader.bfSize,      4);
+    file.write((char*)&header.bitmapFileHeader.bfReserved1, 2);
+    file.write((char*)&header.bitmapFileHeader.bfReserved2, 2);
+    file.write((char*)&header.bitmapFileHeader.bfOffBits,   4);
+
+    // BITMAPINFOHEADER
+    file.write((char*)&header.bitmapInfoHeader.biSize,         4);
+    file.write((char*)&header.bitmapInfoHeader.biWidth,        4);
+    file.write((char*)&header.bitmapInfoHeader.biHeight,       4);
+    file.write((char*)&header.bitmapInfoHeader.biPlanes,       2);
+    file.write((char*)&header.bitmapInfoHeader.biBitCount,     2);
+    file.write((char*)&header.bitmapInfoHeader.biCompression,  4);
+    file.write((char*)&header.bitmapInfoHeader.biSizeImage,    4);
+    file.write((char*)&header.bitmapInfoHeader.biXPixPerMeter, 4);
+    file.write((char*)&header.bitmapInfoHeader.biYPixPerMeter, 4);
+    file.write((char*)&header.bitmapInfoHeader.biClrUsed,      4);
+    file.write((char*)&header.bitmapInfoHeader.biClrImportant, 4);
+
+    // パレット (RGBQUAD: B,G,R,予約 の並び)
+    for(int i=0; i<numColors; i++) {
+        const unsigned char quad[4] = { palette[i].b, palette[i].g, palette[i].r, 0 };
+        file.write((const char*)quad, 4);
+    }
+}
+
+//------------------------------------------------------------------------------
+// 1行分の画素をファイル上のデータに変換する
+//------------------------------------------------------------------------------
+void BitmapEncoder::PackRow(const RGB* pixels, const unsigned char* alpha, unsigned char* dst) {
+
+    const int width = Width();
+
+    switch(Bit()) {
+    case 32:
+        CurrentKernels().packBGRA((const unsigned char*)pixels, alpha, dst, width);
+        break;
+    case 24:
+        CurrentKernels().swapRB((const unsigned char*)pixels, dst, width);
+        break;
+    case 8:
+        ToPaletteIndices(pixels, dst);
+        break;
+    case 4:
+        ToPaletteIndices(pixels, indices.data());
+        std::fill(dst, dst + Stride(), 0);
+        for(int iX=0; iX<width; iX++) {
+            dst[iX/2] |= (iX & 1) ? indices[iX] : (indices[iX] << 4);
+        }
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+// 1行分の画素をパレット番号に変換する
+//
+//   MEMO: グレースケールのパレットなら輝度から直接求め、
+//         そうでなければ最も近い色のパレット番号を探す
+//------------------------------------------------------------------------------
+void BitmapEncoder::ToPaletteIndices(const RGB* pixels, unsigned char* dst) {
+
+    const int width     = Width();
+    const int numColors = NumPaletteColors();
+
+    if(grayscalePalette) {
+        for(int iX=0; iX<width; iX++) {
+            int Y = (77 * pixels[iX].r + 150 * pixels[iX].g + 29 * pixels[iX].b + 128) >> 8;
+            dst[iX] = (unsigned char)((Y * (numColors-1) + 127) / 255);
+        }
+        return;
+    }
+
+    // 直前と同じ色なら探索しない
+    for(int iX=0; iX<width; iX++) {
+        const RGB& c = pixels[iX];
+        if(iX > 0 && c.r == pixels[iX-1].r && c.g == pixels[iX-1].g && c.b == pixels[iX-1].b) {
+            dst[iX] = dst[iX-1];
+            continue;
+        }
+
+        int best = 0, bestDistance = 0x7fffffff;
+        for(int i=0; i<numColors && bestDistance > 0; i++) {
+            int dr = c.r - palette[i].r;
+            int dg = c.g - palette[i].g;
+            int db = c.b - palette[i].b;
+            int distance = dr*dr + dg*dg + db*db;
+            if(distance < bestDistance) {
+                best = i;
+                bestDistance = distance;
+            }
+        }
+        dst[iX] = (unsigned char)best;
+    }
+}
+
+//------------------------------------------------------------------------------
+// 1行分のパレット番号を RLE8, RLE4 で圧縮する (行の終わりは含まない)
+//
+//   MEMO: 3画素以上続く部分は連続モード、それ以外は絶対モードで書き込む
+//         (絶対モードは3画素以上必要なので、2画素以下は連続モードで書く)
+//------------------------------------------------------------------------------
+void BitmapEncoder::EncodeRLE(const unsigned char* row, std::vector<unsigned char>& data) {
+
+    const int width  = Width();
+    const bool isRLE4 = (Compression() == BitmapCodec::BI_RLE4);
+
+    int x = 0;
+    while(x < width) {
+
+        int maxLength = std::min(255, width - x);
+        int run = RunLength(&row[x], maxLength);
+
+        // 連続モード
+        if(run >= 3 || maxLength < 3) {
+            data.push_back((unsigned char)run);
+            data.push_back(isRLE4 ? (unsigned char)((row[x] << 4) | row[x]) : row[x]);
+            x += run;
+            continue;
+        }
+
+        int literal = LiteralLength(&row[x], maxLength);
+
+        // 2画素以下は絶対モードにできないので連続モードで1画素ずつ書く
+        if(literal < 3) {
+            for(int j=0; j<literal; j++) {
+                data.push_back(1);
+                data.push_back(isRLE4 ? (unsigned char)(row[x+j] << 4) : row[x+j]);
+            }
+            x += literal;
+            continue;
+        }
+
+        // 絶対モード (2byte境界に揃える)
+        data.push_back(0);
+        data.push_back((unsigned char)literal);
+        int bytes = 0;
+        if(isRLE4) {
+            for(int j=0; j<literal; j+=2) {
+                int hi = row[x+j];
+                int lo = (j+1 < literal) ? row[x+j+1] : 0;
+                data.push_back((unsigned char)((hi << 4) | lo));
+                bytes++;
+            }
+        }
+        else {
+            data.insert(data.end(), &row[x], &row[x] + literal);
+            bytes = literal;
+        }
+        if(bytes & 1) {
+            data.push_back(0);
+        }
+        x += literal;
+    }
+}
+
+}
@@ -0,0 +1,164 @@
+//==============================================================================
+//
+// Windows Bitmap のコーデック
+//
+//==============================================================================
+#ifndef _MI_BITMAP_CODEC_H_
+#define _MI_BITMAP_CODEC_H_
+
+#include "IImageCodec.h"
+
+#include <vector>
+#include <cstdlib>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// Windows Bitmap のヘッダ
+//------------------------------------------------------------------------------
+struct WindowsBitmapHeader {
+
+    // BitmapFileHeader (Bitmapファイル共通のヘッダ情報)
+    struct BITMAPFILEHEADER {
+        unsigned short bfType      = ('B'|('M'<<8));
+        unsigned int   bfSize      = 54;
+        unsigned short bfReserved1 = 0;
+        unsigned short bfReserved2 = 0;
+        unsigned int   bfOffBits   = 54;
+    };
+
+    // BitmapInfoHeader (Windows Bitmapのヘッダ情報)
+    struct BITMAPINFOHEADER{
+        unsigned int   biSize         = 0;
+        int            biWidth        = 0;
+        int            biHeight       = 0;
+        unsigned short biPlanes       = 1;
+        unsigned short biBitCount     = 24;
+        unsigned int   biCompression  = 0;
+        unsigned int   biSizeImage    = 0;
+        int            biXPixPerMeter = 3780;
+        int            biYPixPerMeter = 3780;
+        unsigned int   biClrUsed      = 0;
+        unsigned int   biClrImportant = 0;
+    };
+
+    BITMAPFILEHEADER bitmapFileHeader;
+    BITMAPINFOHEADER bitmapInfoHeader;
+};
+
+
+//------------------------------------------------------------------------------
+// Windows Bitmap のコーデック (4,8,24,32bitのみ, 4,8bitはRLE圧縮にも対応)
+//------------------------------------------------------------------------------
+class BitmapCodec : public IImageCodec {
+public:
+
+    // 圧縮形式 (biCompression の値)
+    enum {
+        BI_RGB       = 0, // 無圧縮
+        BI_RLE8      = 1, // 8bit ランレングス圧縮
+        BI_RLE4      = 2, // 4bit ランレングス圧縮
+        BI_BITFIELDS = 3, // ビットフィールド (32bitのBGRAのみ対応)
+    };
+
+    const char* Name() const { return "bmp"; }
+    const char* Extension() const { return ".bmp"; }
+
+    bool Sniff(const unsigned char* head, int size) const {
+        return size >= 2 && head[0] == 'B' && head[1] == 'M';
+    }
+
+    std::unique_ptr<IImageDecoder> CreateDecoder() const;
+    std::unique_ptr<IImageEncoder> CreateEncoder() const;
+};
+
+
+//------------------------------------------------------------------------------
+// Windows Bitmap のデコーダ
+//
+// MEMO:
+// 無圧縮の場合は必要な行だけをファイルから読み込む
+// RLE の場合は最初の ReadRows でパレット番号に全体を展開しておく
+//------------------------------------------------------------------------------
+class BitmapDecoder : public IImageDecoder {
+public:
+    ImageInfo ReadHeader(std::istream& stream);
+    void ReadRows(int startRow, int numRows, RGB* pixels, unsigned char* alpha = nullptr);
+
+    // パレット (4,8bit のときのみ)
+    const RGB* Palette() const { return palette; }
+    int NumPaletteColors() const;
+
+private:
+    std::istream* stream = nullptr;
+    WindowsBitmapHeader header;
+    RGB palette[256];
+
+    std::vector<unsigned char> line;    // 1行分の読み込みバッファ
+    std::vector<unsigned char> indices; // RLE を展開したパレット番号 (上の行から)
+
+    int Bit()    const { return header.bitmapInfoHeader.biBitCount; }
+    int Width()  const { return header.bitmapInfoHeader.biWidth; }
+    int Height() const { return header.bitmapInfoHeader.biHeight; }
+    int Compression() const { return header.bitmapInfoHeader.biCompression; }
+    int Stride() const { return (int)((((long long)Width() * Bit() + 31) / 32) * 4); }
+
+    void ReadWindowsBitmapHeader(std::istream& file);
+    void CheckWindowsBitmapHeader();
+    void ReadBitmapPalette(std::istream& file);
+    void DecodeRLE(const std::vector<unsigned char>& data);
+    void UnpackRow(const unsigned char* src, RGB* pixels, unsigned char* alpha);
+};
+
+
+//------------------------------------------------------------------------------
+// Windows Bitmap のエンコーダ
+//
+// MEMO:
+// 無圧縮の場合は上の行から格納する (biHeight が負) ので、シークせずに順に書き込む
+// (書き込み位置を移動しないので std::ostringstream などにも書き込める)
+// RLE は下の行からしか格納できないため行ごとに圧縮して encodedRows に溜めておき、
+// End で下の行からまとめて書き込む (画像1枚分の圧縮データを保持する)
+//------------------------------------------------------------------------------
+class BitmapEncoder : public IImageEncoder {
+public:
+    BitmapEncoder();
+
+    // パレットを設定する (Begin より前に呼ぶ, 既定はグレースケール)
+    void SetPalette(const RGB* palette, int numColors);
+
+    void Begin(std::ostream& stream, const ImageInfo& info);
+    void WriteRows(const RGB* pixels, int numRows, const unsigned char* alpha = nullptr);
+    void End();
+
+private:
+    std::ostream* stream = nullptr;
+    WindowsBitmapHeader header;
+    RGB  palette[256];
+    bool customPalette    = false; // SetPalette でパレットが設定されたか
+    bool grayscalePalette = true;  // パレットがグレースケールか
+    int  row = 0;                  // 次に書き込む行 (上から数える)
+
+    std::vector<unsigned char> line;    // 1行分の書き込みバッファ
+    std::vector<unsigned char> indices; // 1行分のパレット番号
+    std::vector<std::vector<unsigned char>> encodedRows; // RLE で圧縮した各行 (上の行から)
+
+    int Bit()    const { return header.bitmapInfoHeader.biBitCount; }
+    int Width()  const { return header.bitmapInfoHeader.biWidth; }
+    int Height() const { return header.bitmapInfoHeader.biHeight; }
+    int Rows()   const { return abs(Height()); }
+    int Compression() const { return header.bitmapInfoHeader.biCompression; }
+    int Stride() const { return ((Width() * Bit() + 31) / 32) * 4; }
+    int NumPaletteColors() const { return (Bit() <= 8) ? (1 << Bit()) : 0; }
+    bool IsRLE() const { return Compression() == BitmapCodec::BI_RLE8 ||
+                                Compression() == BitmapCodec::BI_RLE4; }
+
+    void WriteWindowsBitmapHeader(unsigned int imageSize);
+    void ToPaletteIndices(const RGB* pixels, unsigned char* indices);
+    void PackRow(const RGB* pixels, const unsigned char* alpha, unsigned char* dst);
+    void EncodeRLE(const unsigned char* indices, std::vector<unsigned char>& data);
+};
+
+}
+
+#endif
@@ -0,0 +1,743 @@
+//==============================================================================
+//
+// 畳み込みエンジン
+//
+//==============================================================================
+#ifndef _MI_CONVOLUTION_H_
+#define _MI_CONVOLUTION_H_
+
+#include "miImage.h"
+#include "miImageProcessing.h"
+#include "miNeighborhood.h"
+#include "miKernels.h"
+
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <tuple>
+#include <thread>
+
+namespace mi {
+
+// 実行時にサイズを決めるカーネルを表す
+const int DynamicSize = 0;
+
+
+//------------------------------------------------------------------------------
+// 畳み込みのカーネル
+//
+// MEMO:
+// W, H を与えると重みを固定長の配列に持ち、constexpr で定義できる
+// 重みは行優先で並べ、中心は (W/2, H/2) とする (偶数サイズでは前寄り)
+//------------------------------------------------------------------------------
+template<class T, int W, int H = W>
+struct Kernel {
+    typedef T Weight;
+
+    T weights[W*H];
+
+    int Width()  const { return W; }
+    int Height() const { return H; }
+    const T* Data() const { return weights; }
+};
+
+//------------------------------------------------------------------------------
+// 畳み込みのカーネル (実行時にサイズを決める)
+//------------------------------------------------------------------------------
+template<class T>
+struct Kernel<T, DynamicSize, DynamicSize> {
+    typedef T Weight;
+
+    Kernel(int width, int height) : width(width), height(height), weights(width*height) {}
+
+    int Width()  const { return width; }
+    int Height() const { return height; }
+    const T* Data() const { return weights.data(); }
+
+    T& operator[](int index) { return weights[index]; }
+
+    int width;
+    int height;
+    std::vector<T> weights;
+};
+
+template<class T> using DynamicKernel = Kernel<T, DynamicSize, DynamicSize>;
+
+//------------------------------------------------------------------------------
+// 重みを型に持つカーネル
+//
+// MEMO:
+// 重みがコンパイル時に決まるので、内側の積和では値が 0 のタップを読み込みごと省き、
+// 残りのタップも定数との積になる
+// 型が違うカーネルを同時に使うときは std::tie でまとめて ConvolveRows に渡す
+//------------------------------------------------------------------------------
+template<class T, int W, int H, T... Ws>
+struct StaticKernel {
+    typedef T Weight;
+
+    static_assert(sizeof...(Ws) == W*H, "StaticKernel needs W*H weights");
+    static constexpr T weights[W*H] = {Ws...};
+
+    int Width()  const { return W; }
+    int Height() const { return H; }
+    const T* Data() const { return weights; }
+};
+
+template<class T, int W, int H, T... Ws>
+constexpr T StaticKernel<T, W, H, Ws...>::weights[W*H];
+
+// Sobel フィルタ (横方向と縦方向の微分)
+typedef StaticKernel<short, 3, 3,
+    -1, 0, 1,
+    -2, 0, 2,
+    -1, 0, 1> SobelXKernel;
+
+typedef StaticKernel<short, 3, 3,
+    -1, -2, -1,
+     0,  0,  0,
+     1,  2,  1> SobelYKernel;
+
+// Laplacian フィルタ (8近傍)
+typedef StaticKernel<short, 3, 3,
+    1,  1, 1,
+    1, -8, 1,
+    1,  1, 1> LaplacianKernel;
+
+//------------------------------------------------------------------------------
+// 箱型カーネル (重みがすべて 1)
+//
+// MEMO:
+// 窓の合計を列ごとの移動和と行内の累積和で求めるので、1画素あたりの
+// 計算量がサイズによらない
+//------------------------------------------------------------------------------
+struct BoxKernel {
+    typedef int Weight;
+
+    int width;
+    int height;
+
+    int Width()  const { return width; }
+    int Height() const { return height; }
+};
+
+
+//------------------------------------------------------------------------------
+// 畳み込みの入力 (1画素が channels 個の要素からなる2次元配列)
+//------------------------------------------------------------------------------
+template<class S>
+struct Plane {
+    const S* data;
+    int width;
+    int height;
+    int channels;
+
+    const S* Row(int y) const { return data + (size_t)y*width*channels; }
+};
+
+inline Plane<unsigned char> MakePlane(const Image& image) {
+    return Plane<unsigned char>{(const unsigned char*)image.data, image.Width(), image.Height(), 3};
+}
+
+
+namespace ConvolutionDetail {
+
+// 内側の積和を分割する要素数 (途中結果が L1 に収まる大きさ)
+const int BlockSize = 1024;
+
+// カーネルの大きさ (コンパイル時に決まらなければ 0)
+template<class K> struct StaticSize {
+    static const int width  = 0;
+    static const int height = 0;
+};
+template<class T, int W, int H> struct StaticSize<Kernel<T, W, H>> {
+    static const int width  = W;
+    static const int height = H;
+};
+template<class T, int W, int H, T... Ws> struct StaticSize<StaticKernel<T, W, H, Ws...>> {
+    static const int width  = W;
+    static const int height = H;
+};
+
+// 0..N-1 の整数の列
+template<int... I> struct Indices {};
+template<int N, int... I> struct MakeIndices : MakeIndices<N-1, N-1, I...> {};
+template<int... I> struct MakeIndices<0, I...> { typedef Indices<I...> Type; };
+
+// 内側の積和 sums[k][p] = Σ w[k][j*kw+i] * rows[j][p + (i-cx)*channels] (k = 0..N-1, p = begin..end-1)
+// (Isa は命令セットごとに別の実体を作るためのもの, miKernels.inl)
+template<class Acc, class S, class T>
+using Accumulate = void (*)(Acc* const* sums, const S* const* rows, const T* const* w,
+                            int kw, int kh, int cx, int channels, int begin, int end);
+
+// 大きさがコンパイル時に決まるときはループを展開して全タップを1回で足し込む
+template<int KW, int KH, class Isa = void> struct AccumulateTaps {
+    template<class Acc, class S, class T>
+    static void Run(Acc* __restrict sum, const S* const* rows, const T* w, int, int, int cx, int channels, int begin, int end) {
+        Acc weights[KW*KH];
+        for(int i=0; i<KW*KH; i++) {
+            weights[i] = (Acc)w[i];
+        }
+        const S* r[KH];
+        for(int j=0; j<KH; j++) {
+            r[j] = rows[j] - cx*channels;
+        }
+        for(int p=begin; p<end; p++) {
+            Acc v = Acc(0);
+            for(int j=0; j<KH; j++) {
+                for(int i=0; i<KW; i++) {
+                    v += weights[j*KW+i] * (Acc)r[j][p + i*channels];
+                }
+            }
+            sum[p] = v;
+        }
+    }
+
+    template<class Acc, class S, class T, int N>
+    static void RunAll(Acc* const* sums, const S* const* rows, const T* const* w, int kw, int kh, int cx, int channels, int begin, int end) {
+        for(int k=0; k<N; k++) {
+            Run(sums[k], rows, w[k], kw, kh, cx, channels, begin, end);
+        }
+    }
+};
+
+// 実行時に決まるときはタップごとに行を足し込む
+template<class Isa> struct AccumulateTaps<0, 0, Isa> {
+    template<class Acc, class S, class T>
+    static void Run(Acc* __restrict sum, const S* const* rows, const T* w, int kw, int kh, int cx, int channels, int begin, int end) {
+        for(int p=begin; p<end; p++) {
+            sum[p] = Acc(0);
+        }
+        for(int j=0; j<kh; j++) {
+            for(int i=0; i<kw; i++) {
+                Acc weight = (Acc)w[j*kw+i];
+                if(weight == Acc(0)) continue;
+                const S* s = rows[j] + (i-cx)*channels;
+                for(int p=begin; p<end; p++) {
+                    sum[p] += weight * (Acc)s[p];
+                }
+            }
+        }
+    }
+
+    template<class Acc, class S, class T, int N>
+    static void RunAll(Acc* const* sums, const S* const* rows, const T* const* w, int kw, int kh, int cx, int channels, int begin, int end) {
+        for(int k=0; k<N; k++) {
+            Run(sums[k], rows, w[k], kw, kh, cx, channels, begin, end);
+        }
+    }
+};
+
+// 重みが型で決まるカーネルの1要素分の積和 (0 のタップは展開時に消える)
+template<class K, class Isa = void> struct StaticTaps;
+
+template<class Isa, class T, int W, int H, T... Ws> struct StaticTaps<StaticKernel<T, W, H, Ws...>, Isa> {
+    template<class Acc, class S>
+    static Acc Sum(const S* const* r, int p, int channels) {
+        typedef StaticKernel<T, W, H, Ws...> K;
+        Acc v = Acc(0);
+        for(int j=0; j<H; j++) {
+            for(int i=0; i<W; i++) {
+                if(K::weights[j*W+i] == T(0)) continue;
+                v += (Acc)K::weights[j*W+i] * (Acc)r[j][p + i*channels];
+            }
+        }
+        return v;
+    }
+};
+
+// 重みが型で決まるカーネルの組は、全カーネルの積和を1回の走査でとる
+// (同じ位置のタップの読み込みはカーネルの間で共有される)
+template<class Kernels, class Isa = void> struct AccumulateStaticTaps;
+
+template<class Isa, class... K> struct AccumulateStaticTaps<std::tuple<K...>, Isa> {
+    template<class Acc, class S, class T>
+    static void Run(Acc* const* sums, const S* const* rows, const T* const*, int, int, int cx, int channels, int begin, int end) {
+        Run(sums, rows, cx, channels, begin, end, typename MakeIndices<sizeof...(K)>::Type());
+    }
+
+private:
+    template<class Acc, class S, int... I>
+    static void Run(Acc* const* sums, const S* const* rows, int cx, int channels, int begin, int end, Indices<I...>) {
+        const int height = StaticSize<typename std::tuple_element<0, std::tuple<K...>>::type>::height;
+        Acc* out[] = { sums[I]... };
+        const S* r[height];
+        for(int j=0; j<height; j++) {
+            r[j] = rows[j] - cx*channels;
+        }
+        // 出力の行と入力の行は重ならない (カーネルが多いと実行時の重なりの検査が
+        // 多すぎてベクトル化されないため、コンパイラに伝える)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+        for(int p=begin; p<end; p++) {
+            const Acc v[] = { StaticTaps<K, Isa>::template Sum<Acc>(r, p, channels)... };
+            int expand[] = { (out[I][p] = v[I], 0)... };
+            (void)expand;
+        }
+    }
+};
+
+// カーネルの型に合った内側の積和
+template<class K, class Acc, class S, int N> struct Taps {
+    typedef typename K::Weight T;
+    static Accumulate<Acc, S, T> Get() {
+        return &AccumulateTaps<StaticSize<K>::width, StaticSize<K>::height>::template RunAll<Acc, S, T, N>;
+    }
+};
+template<class Acc, class S, class T, int W, int H, T... Ws> struct Taps<StaticKernel<T, W, H, Ws...>, Acc, S, 1> {
+    static Accumulate<Acc, S, T> Get() {
+        return &AccumulateStaticTaps<std::tuple<StaticKernel<T, W, H, Ws...>>>::template Run<Acc, S, T>;
+    }
+};
+template<class Acc, class S, class... K> struct Taps<std::tuple<K...>, Acc, S, sizeof...(K)> {
+    typedef typename std::tuple_element<0, std::tuple<K...>>::type::Weight T;
+    static Accumulate<Acc, S, T> Get() {
+        return &AccumulateStaticTaps<std::tuple<K...>>::template Run<Acc, S, T>;
+    }
+};
+
+// 命令セットごとの実体があるもの (miKernels.inl) はカーネル表から選ぶ
+template<> struct Taps<std::tuple<SobelXKernel, SobelYKernel>, short, unsigned char, 2> {
+    static Accumulate<short, unsigned char, short> Get() { return CurrentKernels().accumulateSobel; }
+};
+template<> struct Taps<LaplacianKernel, short, unsigned char, 1> {
+    static Accumulate<short, unsigned char, short> Get() { return CurrentKernels().accumulateLaplacian; }
+};
+template<> struct Taps<DynamicKernel<double>, double, unsigned char, 1> {
+    static Accumulate<double, unsigned char, double> Get() { return CurrentKernels().accumulateDouble; }
+};
+
+// 箱型カーネルの列ごとの窓の合計に行を足す・引く
+template<class Acc, class S>
+using SlideColumns = void (*)(Acc* column, const S* src, int count);
+
+template<class Acc, class S, class Isa = void> struct BoxColumns {
+    static void Add(Acc* __restrict column, const S* src, int count) {
+        for(int p=0; p<count; p++) column[p] += (Acc)src[p];
+    }
+    static void Subtract(Acc* __restrict column, const S* src, int count) {
+        for(int p=0; p<count; p++) column[p] -= (Acc)src[p];
+    }
+};
+
+template<class Acc, class S> struct BoxSlide {
+    static SlideColumns<Acc, S> Add()      { return &BoxColumns<Acc, S>::Add; }
+    static SlideColumns<Acc, S> Subtract() { return &BoxColumns<Acc, S>::Subtract; }
+};
+template<> struct BoxSlide<int, unsigned char> {
+    static SlideColumns<int, unsigned char> Add()      { return CurrentKernels().addColumns; }
+    static SlideColumns<int, unsigned char> Subtract() { return CurrentKernels().subtractColumns; }
+};
+
+// store の呼び方 (行ごとか、行内の区間ごとか)
+template<bool Segmented> struct StoreCall {
+    template<class Store, class Acc>
+    static void Segment(Store&, int, int, int, const Acc* const*, const Acc* const*) {}
+    template<class Store, class Acc>
+    static void Row(Store& store, int iY, const Acc* const* sums, const Acc* const* norms) {
+        store(iY, sums, norms);
+    }
+};
+template<> struct StoreCall<true> {
+    template<class Store, class Acc>
+    static void Segment(Store& store, int iY, int begin, int end, const Acc* const* sums, const Acc* const* norms) {
+        if(begin < end) store(iY, begin, end, sums, norms);
+    }
+    template<class Store, class Acc>
+    static void Row(Store&, int, const Acc* const*, const Acc* const*) {}
+};
+
+// 内側をフィルタ自身の処理に任せない (積和をとって store に渡す)
+struct NoInterior {
+    template<class S>
+    void operator()(int, const S* const*, int, int) const {}
+};
+
+// weights[0..N-1] (同じ大きさ kw x kh のカーネルの重み) で startRow から numRows 行を畳み込む
+// accumulate は全カーネルの内側の積和
+// Segmented なら行を区間に分け、区間の積和が揃うたびに store を呼ぶ
+// interior が NoInterior でなければ、内側は積和をとらずに interior(iY, rows, begin, end) を呼ぶ
+template<BorderPolicy Border, class Acc, int N, bool Segmented, class S, class T, class Store, class Interior>
+void ConvolveRows(const Plane<S>& src, const T* const* weights, Accumulate<Acc, S, T> accumulate,
+                  int kw, int kh, int startRow, int numRows, Store store, Interior interior) {
+
+    const bool fused = !std::is_same<Interior, NoInterior>::value;
+
+    const bool renormalize = (Border == BorderPolicy::Renormalize);
+
+    const int width    = src.width;
+    const int height   = src.height;
+    const int channels = src.channels;
+    const int stride   = width*channels;
+
+    const int cx = kw/2;
+    const int cy = kh/2;
+
+    // 横のタップがすべて画像内に収まる画素の範囲
+    Neighborhood region(width, height, -cx, -cy, kw-1-cx, kh-1-cy);
+    const int begin = region.BeginX();
+    const int end   = region.EndX();
+
+    std::vector<Acc> sums((size_t)N*stride);
+    std::vector<Acc> norms(renormalize ? N*width : 0);
+    std::vector<Acc> columnWeights(renormalize ? kw : 0);
+    std::vector<const S*> rows(kh);            // タップの行 (画像外で足し込まない行は nullptr)
+    std::vector<const S*> taps(kh);            // 内側の積和に使う行 (画像外は zeros)
+    std::vector<S> zeros((size_t)(width+kw)*channels, S(0));
+
+    Acc* sumRows[N];
+    const Acc* normRows[N];
+    for(int k=0; k<N; k++) {
+        sumRows[k]  = &sums[(size_t)k*stride];
+        normRows[k] = renormalize ? &norms[k*width] : nullptr;
+    }
+    const Acc* const* normArg = renormalize ? (const Acc* const*)normRows : nullptr;
+
+    // k 番目のカーネルの端の画素 (範囲チェックをして足し込む)
+    auto border = [&](int k, int iX) {
+        const T* w = weights[k];
+        Acc* sum = &sums[(size_t)k*stride];
+        for(int c=0; c<channels; c++) {
+            sum[iX*channels+c] = Acc(0);
+        }
+        for(int j=0; j<kh; j++) {
+            if(rows[j] == nullptr) continue;
+            for(int i=0; i<kw; i++) {
+                Acc weight = (Acc)w[j*kw+i];
+                int x = MapCoordinate<Border>(iX + i - cx, width);
+                if(weight == Acc(0) || x < 0) continue;
+                for(int c=0; c<channels; c++) {
+                    sum[iX*channels+c] += weight * (Acc)rows[j][x*channels+c];
+                }
+            }
+        }
+    };
+
+    for(int iY=startRow; iY<startRow+numRows; iY++) {
+
+        // タップの行
+        for(int j=0; j<kh; j++) {
+            int y = MapCoordinate<Border>(iY + j - cy, height);
+            rows[j] = (y < 0) ? nullptr : src.Row(y);
+            taps[j] = (y < 0) ? &zeros[cx*channels] : rows[j];
+        }
+
+        // 画素ごとの画像内の重みの合計
+        if(renormalize) {
+            for(int k=0; k<N; k++) {
+                const T* w = weights[k];
+                std::fill(columnWeights.begin(), columnWeights.end(), Acc(0));
+                for(int j=0; j<kh; j++) {
+                    if(rows[j] == nullptr) continue;
+                    for(int i=0; i<kw; i++) {
+                        columnWeights[i] += (Acc)w[j*kw+i];
+                    }
+                }
+                Acc total = Acc(0);
+                for(int i=0; i<kw; i++) {
+                    total += columnWeights[i];
+                }
+
+                Acc* norm = &norms[k*width];
+                for(int iX=0; iX<width; iX++) {
+                    if(iX >= begin && iX < end) {
+                        norm[iX] = total;
+                        continue;
+                    }
+                    norm[iX] = Acc(0);
+                    for(int i=0; i<kw; i++) {
+                        int x = iX + i - cx;
+                        if(x >= 0 && x < width) norm[iX] += columnWeights[i];
+                    }
+                }
+            }
+        }
+
+        // 左端
+        for(int k=0; k<N; k++) {
+            for(int iX=0; iX<begin; iX++) border(k, iX);
+        }
+        StoreCall<Segmented>::Segment(store, iY, 0, begin*channels, (const Acc* const*)sumRows, normArg);
+
+        // 内側 (範囲チェックなしで、ブロックごとに積和をとる)
+        if(fused) {
+            interior(iY, (const S* const*)taps.data(), begin*channels, end*channels);
+        }
+        else for(int block=begin*channels; block<end*channels; block+=BlockSize) {
+            int blockEnd = std::min(end*channels, block+BlockSize);
+            accumulate(sumRows, taps.data(), weights, kw, kh, cx, channels, block, blockEnd);
+            StoreCall<Segmented>::Segment(store, iY, block, blockEnd, (const Acc* const*)sumRows, normArg);
+        }
+
+        // 右端
+        for(int k=0; k<N; k++) {
+            for(int iX=end; iX<width; iX++) border(k, iX);
+        }
+        StoreCall<Segmented>::Segment(store, iY, end*channels, stride, (const Acc* const*)sumRows, normArg);
+
+        StoreCall<Segmented>::Row(store, iY, (const Acc* const*)sumRows, normArg);
+    }
+}
+
+// カーネルの重みを配列にして畳み込む
+template<BorderPolicy Border, class Acc, bool Segmented, class S, class K, class Store, class Interior = NoInterior>
+void ConvolveKernel(const Plane<S>& src, const K& kernel, int startRow, int numRows, Store store,
+                    Interior interior = Interior()) {
+    typedef typename K::Weight T;
+    const T* weights[] = { kernel.Data() };
+    ConvolveRows<Border, Acc, 1, Segmented>(src, weights, Taps<K, Acc, S, 1>::Get(), kernel.Width(), kernel.Height(),
+                                            startRow, numRows, store, interior);
+}
+
+template<BorderPolicy Border, class Acc, bool Segmented, int N, class S, class K, class Store>
+void ConvolveArray(const Plane<S>& src, const K (&kernels)[N], int startRow, int numRows, Store store) {
+    typedef typename K::Weight T;
+    const T* weights[N];
+    for(int k=0; k<N; k++) {
+        weights[k] = kernels[k].Data();
+    }
+    ConvolveRows<Border, Acc, N, Segmented>(src, weights, Taps<K, Acc, S, N>::Get(), kernels[0].Width(), kernels[0].Height(),
+                                            startRow, numRows, store, NoInterior());
+}
+
+// 型の違うカーネルの組 (std::tie でまとめた StaticKernel)
+template<BorderPolicy Border, class Acc, bool Segmented, class S, class... K, int... I, class Store, class Interior>
+void ConvolveTuple(const Plane<S>& src, const std::tuple<K&...>& kernels, Indices<I...>,
+                   int startRow, int numRows, Store store, Interior interior) {
+    typedef std::tuple<typename std::decay<K>::type...> Kernels;
+    typedef typename std::tuple_element<0, Kernels>::type::Weight T;
+    const T* weights[] = { std::get<I>(kernels).Data()... };
+    const auto& first = std::get<0>(kernels);
+    ConvolveRows<Border, Acc, sizeof...(K), Segmented>(src, weights, Taps<Kernels, Acc, S, sizeof...(K)>::Get(),
+                                                       first.Width(), first.Height(), startRow, numRows, store, interior);
+}
+
+template<BorderPolicy Border, class Acc, bool Segmented, class S, class... K, class Store, class Interior = NoInterior>
+void ConvolveTuple(const Plane<S>& src, const std::tuple<K&...>& kernels, int startRow, int numRows, Store store,
+                   Interior interior = Interior()) {
+    ConvolveTuple<Border, Acc, Segmented>(src, kernels, typename MakeIndices<sizeof...(K)>::Type(),
+                                          startRow, numRows, store, interior);
+}
+
+}
+
+
+//------------------------------------------------------------------------------
+// 畳み込み (src の startRow から numRows 行)
+//
+// MEMO:
+// 行ごとに store(iY, sums, norms) を呼ぶ
+//   sums : その行の要素ごとの Σ 重み*画素 (width*channels 個, 画素の順にチャンネルが並ぶ)
+//   norms: Renormalize のときは画素ごとの画像内の重みの合計 (width 個), それ以外は nullptr
+// 画素と重みは Acc に変換してから積和をとる
+// 内側の画素は範囲チェックなしにタップごとに行をまとめて足し込むので
+// (カーネルの大きさが固定ならループが展開され) コンパイラがベクトル化できる
+// 値が 0 の重みは足し込まない (StaticKernel ではコンパイル時に省く)
+//------------------------------------------------------------------------------
+template<BorderPolicy Border, class Acc, class S, class K, class Store>
+void ConvolveRows(const Plane<S>& src, const K& kernel, int startRow, int numRows, Store store) {
+    ConvolutionDetail::ConvolveKernel<Border, Acc, false>(src, kernel, startRow, numRows,
+        [&](int iY, const Acc* const* sums, const Acc* const* norms) {
+            store(iY, sums[0], norms ? norms[0] : nullptr);
+        });
+}
+
+// 同じ大きさの N 個のカーネルで同時に畳み込む
+// store(iY, sums, norms) の sums, norms はカーネルごとの配列になる
+template<BorderPolicy Border, class Acc, int N, class S, class K, class Store>
+void ConvolveRows(const Plane<S>& src, const K (&kernels)[N], int startRow, int numRows, Store store) {
+    ConvolutionDetail::ConvolveArray<Border, Acc, false>(src, kernels, startRow, numRows, store);
+}
+
+// 型の違うカーネル (重みの型と大きさは同じ) で同時に畳み込む
+// ConvolveRows<Border, Acc>(src, std::tie(kernelX, kernelY), startRow, numRows, store)
+template<BorderPolicy Border, class Acc, class S, class... K, class Store>
+void ConvolveRows(const Plane<S>& src, const std::tuple<K&...>& kernels, int startRow, int numRows, Store store) {
+    ConvolutionDetail::ConvolveTuple<Border, Acc, false>(src, kernels, startRow, numRows, store);
+}
+
+//------------------------------------------------------------------------------
+// 畳み込み (行内の区間ごとに結果を受け取る)
+//
+// MEMO:
+// ConvolveRows と同じ畳み込みで、store(iY, begin, end, sums, norms) を行内の
+// 要素の区間 [begin, end) ごとに左から順に呼ぶ (sums, norms は行の先頭を指し、
+// その区間の値だけが有効)
+// 区間の積和がキャッシュにあるうちに書き出すので、結果を1画素ずつ変換するだけの
+// フィルタ (Sobel, Laplacian) では行ごとの ConvolveRows より速い
+// interior を渡すと、範囲チェックのいらない内側 [begin, end) は積和をとらずに
+// interior(iY, rows, begin, end) を呼ぶ (rows はタップの行 kh 本の先頭で、画像外の行は 0 の行)
+// 積和と変換をまとめて SIMD で書いたフィルタ固有の処理で内側を置き換えるためのもので、
+// 端は引き続き Border に従った積和が store に渡る
+//------------------------------------------------------------------------------
+template<BorderPolicy Border, class Acc, class S, class K, class Store,
+         class Interior = ConvolutionDetail::NoInterior>
+void ConvolveSegments(const Plane<S>& src, const K& kernel, int startRow, int numRows, Store store,
+                      Interior interior = Interior()) {
+    ConvolutionDetail::ConvolveKernel<Border, Acc, true>(src, kernel, startRow, numRows,
+        [&](int iY, int begin, int end, const Acc* const* sums, const Acc* const* norms) {
+            store(iY, begin, end, sums[0], norms ? norms[0] : nullptr);
+        }, interior);
+}
+
+template<BorderPolicy Border, class Acc, int N, class S, class K, class Store>
+void ConvolveSegments(const Plane<S>& src, const K (&kernels)[N], int startRow, int numRows, Store store) {
+    ConvolutionDetail::ConvolveArray<Border, Acc, true>(src, kernels, startRow, numRows, store);
+}
+
+template<BorderPolicy Border, class Acc, class S, class... K, class Store,
+         class Interior = ConvolutionDetail::NoInterior>
+void ConvolveSegments(const Plane<S>& src, const std::tuple<K&...>& kernels, int startRow, int numRows, Store store,
+                      Interior interior = Interior()) {
+    ConvolutionDetail::ConvolveTuple<Border, Acc, true>(src, kernels, startRow, numRows, store, interior);
+}
+
+// 箱型カーネル
+template<BorderPolicy Border, class Acc, class S, class Store>
+void ConvolveRows(const Plane<S>& src, const BoxKernel& kernel, int startRow, int numRows, Store store) {
+
+    const bool renormalize = (Border == BorderPolicy::Renormalize);
+
+    const int width    = src.width;
+    const int height   = src.height;
+    const int channels = src.channels;
+    const int stride   = width*channels;
+
+    const int kw = kernel.width;
+    const int kh = kernel.height;
+    const int cx = kw/2;
+    const int cy = kh/2;
+
+    std::vector<Acc> column(stride, Acc(0));                 // 列ごとの窓の合計
+    std::vector<Acc> prefix((size_t)(width+kw)*channels, Acc(0)); // 延長した行の累積和
+    std::vector<Acc> sums(stride);
+    std::vector<Acc> norms(renormalize ? width : 0);
+
+    // 列ごとの合計に y 行目を足す・引く
+    const ConvolutionDetail::SlideColumns<Acc, S> addColumns      = ConvolutionDetail::BoxSlide<Acc, S>::Add();
+    const ConvolutionDetail::SlideColumns<Acc, S> subtractColumns = ConvolutionDetail::BoxSlide<Acc, S>::Subtract();
+    auto addRow = [&](int y) {
+        y = MapCoordinate<Border>(y, height);
+        if(y < 0) return;
+        addColumns(column.data(), src.Row(y), stride);
+    };
+    auto subRow = [&](int y) {
+        y = MapCoordinate<Border>(y, height);
+        if(y < 0) return;
+        subtractColumns(column.data(), src.Row(y), stride);
+    };
+
+    // 開始行の窓に含まれる行を積む
+    for(int j=0; j<kh; j++) {
+        addRow(startRow - cy + j);
+    }
+
+    for(int iY=startRow; iY<startRow+numRows; iY++) {
+
+        // 窓を1行下へずらす
+        if(iY > startRow) {
+            subRow(iY - 1 - cy);
+            addRow(iY - 1 - cy + kh);
+        }
+
+        // 左右へ延長した行 (延長後の座標 v が元の v-cx 画素目) の累積和
+        for(int v=0; v<width+kw-1; v++) {
+            int x = MapCoordinate<Border>(v - cx, width);
+            for(int c=0; c<channels; c++) {
+                prefix[(v+1)*channels+c] = prefix[v*channels+c] + ((x < 0) ? Acc(0) : column[x*channels+c]);
+            }
+        }
+        const Acc* add = &prefix[kw*channels];
+        for(int p=0; p<stride; p++) {
+            sums[p] = add[p] - prefix[p];
+        }
+
+        // 画像内の画素数
+        if(renormalize) {
+            int rows = std::min(height-1, iY-cy+kh-1) - std::max(0, iY-cy) + 1;
+            for(int iX=0; iX<width; iX++) {
+                norms[iX] = (Acc)(rows * (std::min(width-1, iX-cx+kw-1) - std::max(0, iX-cx) + 1));
+            }
+        }
+
+        store(iY, (const Acc*)sums.data(), renormalize ? (const Acc*)norms.data() : nullptr);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// 任意のカーネルによる畳み込みフィルタ
+//
+// MEMO:
+// 結果は四捨五入して 0..255 に収める (Renormalize では画像内の重みの合計で割る)
+// 重みが整数なら int, 浮動小数点数ならその型で積和をとる
+//------------------------------------------------------------------------------
+class ConvolutionFilter : IImageProcessing {
+public:
+    template<class K>
+    ConvolutionFilter(Image& image, const K& kernel, BorderPolicy border = BorderPolicy::Clamp) {
+        switch(border) {
+        case BorderPolicy::Clamp:       ProcessKernel<BorderPolicy::Clamp>(image, kernel);       break;
+        case BorderPolicy::Mirror:      ProcessKernel<BorderPolicy::Mirror>(image, kernel);      break;
+        case BorderPolicy::Zero:        ProcessKernel<BorderPolicy::Zero>(image, kernel);        break;
+        case BorderPolicy::Renormalize: ProcessKernel<BorderPolicy::Renormalize>(image, kernel); break;
+        }
+    }
+
+    template<class K>
+    static void Process(Image& image, const K& kernel, BorderPolicy border = BorderPolicy::Clamp) {
+        ConvolutionFilter filter(image, kernel, border);
+    }
+
+private:
+    // 四捨五入して 0..255 に収める
+    static unsigned char Saturate(int value) {
+        return (unsigned char)std::min(255, std::max(0, value));
+    }
+    template<class T> static unsigned char Saturate(T value) {
+        return (unsigned char)std::min(T(255), std::max(T(0), value + T(0.5)));
+    }
+
+    // 1行分の結果を書き込む (norms があれば画素ごとに割る)
+    template<class Acc>
+    static void StoreRow(const Acc* sums, const Acc* norms, unsigned char* dst, int width) {
+        if(norms) {
+            for(int iX=0; iX<width; iX++) {
+                double inv = 1.0 / norms[iX];
+                for(int c=0; c<3; c++) {
+                    dst[iX*3+c] = Saturate(sums[iX*3+c] * inv);
+                }
+            }
+        }
+        else {
+            for(int p=0; p<width*3; p++) {
+                dst[p] = Saturate(sums[p]);
+            }
+        }
+    }
+
+    template<BorderPolicy Border, class K>
+    void ProcessKernel(Image& image, const K& kernel) {
+
+        typedef typename K::Weight Weight;
+        typedef typename std::conditional<std::is_integral<Weight>::value, int, Weight>::type Acc;
+
+        // コピー
+        Image copy = image;
+        Plane<unsigned char> src = MakePlane(copy);
+
+        Processing = [&](int startRow, int numRows) {
+            ConvolveRows<Border, Acc>(src, kernel, startRow, numRows,
+                [&](int iY, const Acc* sums, const Acc* norms) {
+                    StoreRow(sums, norms, (unsigned char*)&image.data[iY*image.Width()], image.Width());
+                });
+        };
+
+        // Processingの処理をおこなう
+        RunRows(image, std::thread::hardware_concurrency());
+    }
+};
+
+}
+
+#endif
@@ -4,6 +4,8 @@
 //
 //==============================================================================
 #include "miDepthProcessing.h"
+#include "miNeighborhood.h"
+#include "miPointPipeline.h"
 
 #include <vector>
 #include <thread>
@@ -63,26 +65,7 @@ struct dRGB {
 // Logistic フィルタ
 //------------------------------------------------------------------------------
 LogisticFilter::LogisticFilter(Image& image, double paramA, double paramB) {
-
-    // 参照テーブル
-    unsigned char LUT[256];
-
-    // 参照テーブル作成
-    for(int i=0; i<256; i++) {
-        LUT[i] = (unsigned char)( 255/(1+exp(-paramA*(i-paramB))) );
-    }
-
-    // 処理本体
-    Processing = [&](int start, int length) {
-        for(int i=start; i<start+length; i++) {
-            image.data[i].r = LUT[image.data[i].r];
-            image.data[i].g = LUT[image.data[i].g];
-            image.data[i].b = LUT[image.data[i].b];
-        }
-    };
-
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    PointPipeline().Logistic(paramA, paramB).Process(image);
 }
 
 
@@ -92,52 +75,47 @@ LogisticFilter::LogisticFilter(Image& image, double paramA, double paramB) {
 MedianTSFilter::MedianTSFilter(Image& image,
                                std::vector<Image> inputs, int filterSize) {
 
-    // 画像処理本体
-    Processing = [&](int start, int length) {
+    int width = image.Width();
+    Neighborhood region(width, image.Height(), filterSize);
 
-        int halfSize = filterSize/2;
-        int sqrSize  = filterSize*filterSize;
+    // 画像処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows) {
 
-        unsigned char* R = new unsigned char[sqrSize*inputs.size()];
-        unsigned char* G = new unsigned char[sqrSize*inputs.size()];
-        unsigned char* B = new unsigned char[sqrSize*inputs.size()];
+        int sqrSize = filterSize*filterSize;
 
-        for(int i=start; i<start+length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        std::vector<unsigned char> R(sqrSize*inputs.size());
+        std::vector<unsigned char> G(sqrSize*inputs.size());
+        std::vector<unsigned char> B(sqrSize*inputs.size());
 
-            int pixelCount = 0;
+        // 画像内の窓 [x0, x1] x [y0, y1] の全入力の中央値
+        auto median = [&](int iX, int iY, int x0, int y0, int x1, int y1) {
 
-            for(int j=0; j<sqrSize; j++){
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
-
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+            int pixelCount = 0;
 
-                for(auto& images : inputs) {
-                    R[pixelCount] = images.pixel[jX][jY].r;
-                    G[pixelCount] = images.pixel[jX][jY].g;
-                    B[pixelCount] = images.pixel[jX][jY].b;
-                    pixelCount++;
+            for(int jY=y0; jY<=y1; jY++) {
+                for(int jX=x0; jX<=x1; jX++) {
+                    for(auto& images : inputs) {
+                        const RGB& pixel = images.data[jY*width + jX];
+                        R[pixelCount] = pixel.r;
+                        G[pixelCount] = pixel.g;
+                        B[pixelCount] = pixel.b;
+                        pixelCount++;
+                    }
                 }
             }
 
-            std::sort(R, R+pixelCount);
-            std::sort(G, G+pixelCount);
-            std::sort(B, B+pixelCount);
+            std::sort(R.begin(), R.begin()+pixelCount);
+            std::sort(G.begin(), G.begin()+pixelCount);
+            std::sort(B.begin(), B.begin()+pixelCount);
 
-            image.pixel[iX][iY].r = R[pixelCount/2];
-            image.pixel[iX][iY].g = G[pixelCount/2];
-            image.pixel[iX][iY].b = B[pixelCount/2];
-        }
+            image.data[iY*width + iX] = RGB(R[pixelCount/2], G[pixelCount/2], B[pixelCount/2]);
+        };
 
-        delete[] R;
-        delete[] G;
-        delete[] B;
+        region.ForEachWindow(startRow, numRows, median);
     };
 
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
 }
 
 
@@ -162,52 +140,226 @@ TrilateralFilter::TrilateralFilter(Image& image, Image& reference,
         LUT[ i ] = exp(-(iX*iX+iY*iY)/sig);
     }
 
+    // 値の差に対する重み
+    RangeWeightTable range(sig2);
+
     // コピー
     Image copy = image;
 
-    // 処理本体
-    Processing = [&](int start, int length){
+    int width = image.Width();
+    Neighborhood region(width, image.Height(), filterSize);
+
+    // 処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows){
 
-        for(int i=start; i<start + length; i++) {
+        // 画像内の窓 [x0, x1] x [y0, y1] で (iX, iY) を処理する (マスクと同じ順に足し込む)
+        auto process = [&](int iX, int iY, int x0, int y0, int x1, int y1) {
 
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+            int i = iY*width + iX;
+            const RGB& center = reference.data[i];
 
             dRGB sum; // ピクセルとの計算結果合計値
             dRGB div; // 正規化用のフィルタ値合計
 
-            for(int j=0; j<filterSize*filterSize; j++) {
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
+            for(int jY=y0; jY<=y1; jY++) {
+                const double* mask = &LUT[(jY-iY+halfSize)*filterSize];
 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+                for(int jX=x0; jX<=x1; jX++) {
+                    const RGB& guide = reference.data[jY*width + jX];
+                    const RGB& pixel = copy.data[jY*width + jX];
+                    double spatial = mask[jX-iX+halfSize];
 
-                dRGB diff   = reference.pixel[iX][iY] - reference.pixel[jX][jY];
-                dRGB weight = dRGB::exp( diff*diff / -sig2 );
-                dRGB filter = weight * LUT[j];
+                    // MEMO: 差は RGB 同士の引き算なので 0..255 に丸められている (従来どおり)
+                    dRGB filter;
+                    filter.r = range((unsigned char)(center.r - guide.r)) * spatial;
+                    filter.g = range((unsigned char)(center.g - guide.g)) * spatial;
+                    filter.b = range((unsigned char)(center.b - guide.b)) * spatial;
 
-                sum += filter * copy.pixel[jX][jY];
-                div += filter;
+                    sum.r += filter.r * pixel.r;
+                    sum.g += filter.g * pixel.g;
+                    sum.b += filter.b * pixel.b;
+                    div += filter;
+                }
             }
 
-            image.pixel[iX][iY] = RGB(sum.r/div.r, sum.g/div.g, sum.b/div.b);
-        }
+            image.data[i] = RGB(sum.r/div.r, sum.g/div.g, sum.b/div.b);
+        };
+
+        region.ForEachWindow(startRow, numRows, process);
     };
 
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
 
     delete[] LUT;
 }
 
+//------------------------------------------------------------------------------
+// Guided フィルタ (He et al.)
+//------------------------------------------------------------------------------
+GuidedFilter::GuidedFilter(Image& image, Image& reference, int filterSize, double epsilon) {
+
+    int width  = image.Width();
+    int height = image.Height();
+    int numThreads = std::thread::hardware_concurrency();
+
+    // 深度画像などグレースケール同士なら1チャンネルだけ計算してコピーする
+    int numChannels = (image.IsGrayscale() && reference.IsGrayscale()) ? 1 : 3;
+
+    // チャンネルごとに I, p, I*p, I*I を並べる (I: ガイド, p: 入力)
+    std::vector<float> moments((size_t)image.Size() * numChannels*4);
+
+    Processing = [&](int start, int length) {
+        for(int i=start; i<start+length; i++) {
+            const unsigned char* guide = (const unsigned char*)&reference.data[i];
+            const unsigned char* input = (const unsigned char*)&image.data[i];
+            float* dst = &moments[(size_t)i*numChannels*4];
+            for(int c=0; c<numChannels; c++) {
+                float I = guide[c] / 255.0f;
+                float p = input[c] / 255.0f;
+                dst[c*4+0] = I;
+                dst[c*4+1] = p;
+                dst[c*4+2] = I*p;
+                dst[c*4+3] = I*I;
+            }
+        }
+    };
+    Run(image, numThreads);
+    if(numChannels == 1) BoxMean<4>(moments, width, height, filterSize);
+    else                 BoxMean<12>(moments, width, height, filterSize);
+
+    // 局所的な線形モデル q = a*I + b の係数 (チャンネルごとに a, b)
+    std::vector<float> coefficients((size_t)image.Size() * numChannels*2);
+
+    Processing = [&](int start, int length) {
+        for(int i=start; i<start+length; i++) {
+            const float* mean = &moments[(size_t)i*numChannels*4];
+            float* dst = &coefficients[(size_t)i*numChannels*2];
+            for(int c=0; c<numChannels; c++) {
+                float meanI  = mean[c*4+0];
+                float meanP  = mean[c*4+1];
+                float covIP  = mean[c*4+2] - meanI*meanP;
+                float varI   = mean[c*4+3] - meanI*meanI;
+                float a = covIP / (varI + (float)epsilon);
+                dst[c*2+0] = a;
+                dst[c*2+1] = meanP - a*meanI;
+            }
+        }
+    };
+    Run(image, numThreads);
+    if(numChannels == 1) BoxMean<2>(coefficients, width, height, filterSize);
+    else                 BoxMean<6>(coefficients, width, height, filterSize);
+
+    // 出力
+    Processing = [&](int start, int length) {
+        for(int i=start; i<start+length; i++) {
+            const unsigned char* guide = (const unsigned char*)&reference.data[i];
+            unsigned char* dst = (unsigned char*)&image.data[i];
+            const float* mean = &coefficients[(size_t)i*numChannels*2];
+            for(int c=0; c<numChannels; c++) {
+                float q = (mean[c*2+0] * (guide[c] / 255.0f) + mean[c*2+1]) * 255.0f + 0.5f;
+                dst[c] = (unsigned char)std::min(255.0f, std::max(0.0f, q));
+            }
+            if(numChannels == 1) {
+                dst[1] = dst[0];
+                dst[2] = dst[0];
+            }
+        }
+    };
+    Run(image, numThreads);
+}
+
+//------------------------------------------------------------------------------
+// Guided フィルタ 平均化 (横は移動和, 縦は列ごとの移動和)
+//------------------------------------------------------------------------------
+template<int NumPlanes>
+void GuidedFilter::BoxMean(std::vector<float>& planes, int width, int height, int filterSize) {
+
+    // 注目画素からの窓の範囲 (偶数サイズでは前寄り)
+    int lo = -(filterSize/2);
+    int hi = filterSize - 1 + lo;
+    int stride = width * NumPlanes;
+
+    // 列ごとの窓の画素数の逆数
+    std::vector<float> invCols(width);
+    for(int iX=0; iX<width; iX++) {
+        invCols[iX] = 1.0f / (std::min(width-1, iX+hi) - std::max(0, iX+lo) + 1);
+    }
+
+    // 横方向の合計
+    std::vector<float> sums(planes.size());
+
+    Processing = [&](int startRow, int numRows) {
+        for(int iY=startRow; iY<startRow+numRows; iY++) {
+            const float* src = &planes[(size_t)iY*stride];
+            float*       dst = &sums[(size_t)iY*stride];
+
+            float sum[NumPlanes] = {0};
+            for(int x=0; x<=std::min(width-1, hi); x++) {
+                for(int k=0; k<NumPlanes; k++) sum[k] += src[x*NumPlanes+k];
+            }
+            for(int iX=0; iX<width; iX++) {
+                if(iX > 0) {
+                    if(iX-1+lo >= 0) {
+                        for(int k=0; k<NumPlanes; k++) sum[k] -= src[(iX-1+lo)*NumPlanes+k];
+                    }
+                    if(iX+hi < width) {
+                        for(int k=0; k<NumPlanes; k++) sum[k] += src[(iX+hi)*NumPlanes+k];
+                    }
+                }
+                for(int k=0; k<NumPlanes; k++) dst[iX*NumPlanes+k] = sum[k];
+            }
+        }
+    };
+    RunRows(height, std::thread::hardware_concurrency());
+
+    // 縦方向の合計から平均を求める
+    // (移動和は BlockRows 行ごとに始め直し、RunRows の分け方 (スレッド数) によらず
+    //  同じ順序で足し引きする。バンドがブロックの途中から始まる場合はブロックの
+    //  先頭から移動和を進めておく)
+    const int BlockRows = 64;
+
+    Processing = [&](int startRow, int numRows) {
+        std::vector<double> sum(stride);
+
+        auto addRow = [&](int y, double sign) {
+            const float* src = &sums[(size_t)y*stride];
+            for(int p=0; p<stride; p++) sum[p] += sign * src[p];
+        };
+
+        for(int iY=startRow-startRow%BlockRows; iY<startRow+numRows; iY++) {
+            if(iY % BlockRows == 0) {
+                std::fill(sum.begin(), sum.end(), 0.0);
+                for(int y=std::max(0,iY+lo); y<=std::min(height-1,iY+hi); y++) {
+                    addRow(y, 1);
+                }
+            }
+            else {
+                if(iY-1+lo >= 0)   addRow(iY-1+lo, -1);
+                if(iY+hi < height) addRow(iY+hi, 1);
+            }
+            if(iY < startRow) continue;
+
+            float invRows = 1.0f / (std::min(height-1,iY+hi) - std::max(0,iY+lo) + 1);
+
+            float* dst = &planes[(size_t)iY*stride];
+            for(int iX=0; iX<width; iX++) {
+                float scale = invCols[iX] * invRows;
+                for(int k=0; k<NumPlanes; k++) {
+                    dst[iX*NumPlanes+k] = (float)(sum[iX*NumPlanes+k] * scale);
+                }
+            }
+        }
+    };
+    RunRows(height, std::thread::hardware_concurrency());
+}
+
 //------------------------------------------------------------------------------
 // Quadrilateral フィルタ
 //------------------------------------------------------------------------------
 QuadrilateralFilter::QuadrilateralFilter(Image& image,
                 Image color, Image laser, Image camera, int filterSize) {
 
-    int halfSize = filterSize/2;
-
     // パラメータ
     double sigma  = 0.03;
     double sigma2 = 0.1;
@@ -230,13 +382,13 @@ QuadrilateralFilter::QuadrilateralFilter(Image& image,
     
     Image sub = image;
     
+    Neighborhood region(image.Width(), image.Height(), filterSize);
     
-    // 処理本体
-    Processing = [&](int start, int length) {
+    // 処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows) {
 
-        for(int i=start; i<start+length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        // 画像内の窓 [x0, x1] x [y0, y1] で (iX, iY) を処理する
+        auto process = [&](int iX, int iY, int x0, int y0, int x1, int y1) {
 
             dRGB sumA; // ピクセルとの計算結果合計値
             dRGB sumB;
@@ -245,37 +397,35 @@ QuadrilateralFilter::QuadrilateralFilter(Image& image,
             dRGB suA;
             dRGB suB;
 
-            for(int j=0; j<filterSize*filterSize; j++) {
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
-
-                if( jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+            for(int jY=y0; jY<=y1; jY++) {
+                for(int jX=x0; jX<=x1; jX++) {
                 
-                dRGB one(1,1,1);
+                    dRGB one(1,1,1);
 
-                dRGB laserDiff = dRGB::abs(laser.pixel[iX][iY] - laser.pixel[jX][jY]) / 255;
-                dRGB colorDiff = dRGB::abs(color.pixel[iX][iY] - color.pixel[jX][jY]) / 255;
-                dRGB cameraDiff= dRGB::abs(camera.pixel[iX][iY]- camera.pixel[jX][jY])/ 255;
-                //dRGB camLsrDiff = dRGB::abs(camera.pixel[iX][iY]-laser.pixel[iX][iY]) / 255;
+                    dRGB laserDiff = dRGB::abs(laser.pixel[iX][iY] - laser.pixel[jX][jY]) / 255;
+                    dRGB colorDiff = dRGB::abs(color.pixel[iX][iY] - color.pixel[jX][jY]) / 255;
+                    dRGB cameraDiff= dRGB::abs(camera.pixel[iX][iY]- camera.pixel[jX][jY])/ 255;
+                    //dRGB camLsrDiff = dRGB::abs(camera.pixel[iX][iY]-laser.pixel[iX][iY]) / 255;
 
                 
-                // カラーとカメラのが両方ともエッジを検出しないと weight が小さくなる
-                // 両方ともエッジを検出すると weight が大きくなる
-                dRGB weight = one - dRGB::exp(cameraDiff*colorDiff/-sig);
+                    // カラーとカメラのが両方ともエッジを検出しないと weight が小さくなる
+                    // 両方ともエッジを検出すると weight が大きくなる
+                    dRGB weight = one - dRGB::exp(cameraDiff*colorDiff/-sig);
 
-                // レーザとカメラのエッジを検出しない画素からの色
-                dRGB a = dRGB::exp(laserDiff*laserDiff/-sig2) * dRGB::exp(cameraDiff*colorDiff/-sig2);
+                    // レーザとカメラのエッジを検出しない画素からの色
+                    dRGB a = dRGB::exp(laserDiff*laserDiff/-sig2) * dRGB::exp(cameraDiff*colorDiff/-sig2);
                 
-                // レーザのエッジを検出し、カメラのエッジを検出しない画素からの色
-                dRGB b = (one - dRGB::exp(laserDiff*laserDiff/-sig3)) * dRGB::exp(cameraDiff*colorDiff/-sig3);
+                    // レーザのエッジを検出し、カメラのエッジを検出しない画素からの色
+                    dRGB b = (one - dRGB::exp(laserDiff*laserDiff/-sig3)) * dRGB::exp(cameraDiff*colorDiff/-sig3);
                 
 
-                sumA += a * laser.pixel[jX][jY] * (one-weight);
-                sumB += b * laser.pixel[jX][jY] * weight;
-                div += a*(one-weight) + b*weight;
+                    sumA += a * laser.pixel[jX][jY] * (one-weight);
+                    sumB += b * laser.pixel[jX][jY] * weight;
+                    div += a*(one-weight) + b*weight;
                 
-                suA += a * (one-weight);
-                suB += b * weight;
+                    suA += a * (one-weight);
+                    suB += b * weight;
+                }
             }
             
             dRGB sum = (sumA+sumB) / div;
@@ -293,12 +443,14 @@ QuadrilateralFilter::QuadrilateralFilter(Image& image,
             sub.pixel[iX][iY].r = sA.r;
             sub.pixel[iX][iY].g = sB.g;
             sub.pixel[iX][iY].b = sB.b;
-        }
+        };
+        
+        region.ForEachWindow(startRow, numRows, process);
     };
     
 
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
     
     
     sub.Save("depth_output_sub.bmp");
@@ -50,6 +50,30 @@ public:
 };
 
     
+//------------------------------------------------------------------------------
+// Guided フィルタ (He et al.)
+//
+// MEMO:
+// reference をガイドとしてチャンネルごとに image を平滑化する (Trilateral と同じく
+// ガイドの R は image の R に対応する)。値は 0..1 に正規化して扱い、epsilon は
+// その2乗の単位 (0.01 なら標準偏差 0.1 程度の変化を平滑化する)
+// 平均はすべて移動和で求めるので、1画素あたりの計算量は filterSize によらない
+// image と reference が両方グレースケールなら1チャンネル分だけ計算する
+//------------------------------------------------------------------------------
+class GuidedFilter : IImageProcessing {
+public:
+    GuidedFilter(Image& image, Image& reference, int filterSize, double epsilon);
+    static void Process(Image& image, Image& reference, int filterSize, double epsilon) {
+        GuidedFilter filter(image, reference, filterSize, epsilon);
+    }
+
+private:
+    // 画素ごとに NumPlanes 個の値を並べた planes を、filterSize 四方の平均に置き換える
+    template<int NumPlanes>
+    void BoxMean(std::vector<float>& planes, int width, int height, int filterSize);
+};
+
+
 //------------------------------------------------------------------------------
 // Quadrilateral フィルタ
 //------------------------------------------------------------------------------
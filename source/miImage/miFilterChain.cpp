@@ -0,0 +1,236 @@
+//==============================================================================
+//
+// フィルタチェイン (文字列で指定したフィルタを順番に適用する)
+//
+//==============================================================================
+#include "miFilterChain.h"
+
+#include "miImageProcessing.h"
+#include "miDepthProcessing.h"
+#include "miPointPipeline.h"
+#include "miFilterGraph.h"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <memory>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// フィルタの定義
+//------------------------------------------------------------------------------
+struct FilterEntry {
+    const char* name;     // チェインで指定する名前
+    const char* usage;    // 引数の説明
+    int minArgs;          // 必須の引数の数
+    int maxArgs;          // 指定できる引数の数
+    double defaults[3];   // 省略時の引数
+
+    // 出力の1画素が依存する入力の範囲の半径 (FilterGraph の halo)
+    int (*halo)(const double* args);
+
+    // 引数からフィルタ本体を生成する
+    std::function<void(Image&)> (*create)(const double* args);
+
+    // 点処理の場合は create の代わりにパイプラインへ段を追加する
+    // (連続する点処理は1つのパイプラインにまとめて1回の走査で適用する)
+    void (*point)(PointPipeline& pipeline, const double* args);
+};
+
+const FilterEntry filterEntries[] = {
+    { "mono",      "",                         0, 0, {0},
+        [](const double*) { return 0; },
+        nullptr,
+        [](PointPipeline& p, const double*) { p.Monochrome(); } },
+    { "dither",    "",                         0, 0, {0},
+        [](const double*) { return FilterGraph::Global; },
+        [](const double*) -> std::function<void(Image&)> {
+            return [](Image& image) { DitheringErrorDiffusion::Process(image); };
+        },
+        nullptr },
+    { "binarize",  "[:threshold=127]",         0, 1, {127},
+        [](const double*) { return 0; },
+        nullptr,
+        [](PointPipeline& p, const double* a) { p.Binarize((int)a[0]); } },
+    { "abinarize", "[:size=15[:k=0.2]]",      0, 2, {15, 0.2},
+        [](const double* a) { return (int)a[0]/2; },
+        [](const double* a) -> std::function<void(Image&)> {
+            int size = (int)a[0]; double k = a[1];
+            return [=](Image& image) { AdaptiveBinarize::Process(image, size, k); };
+        },
+        nullptr },
+    { "median",    "[:size=3]",                0, 1, {3},
+        [](const double* a) { return (int)a[0]/2; },
+        [](const double* a) -> std::function<void(Image&)> {
+            int size = (int)a[0];
+            return [=](Image& image) { MedianFilter::Process(image, size); };
+        },
+        nullptr },
+    { "average",   "[:size=3]",                0, 1, {3},
+        [](const double* a) { return (int)a[0]/2; },
+        [](const double* a) -> std::function<void(Image&)> {
+            int size = (int)a[0];
+            return [=](Image& image) { AverageFilter::Process(image, size); };
+        },
+        nullptr },
+    { "gauss",     "[:size=5[:sigma=1.0]]",    0, 2, {5, 1.0},
+        [](const double* a) { return (int)a[0]/2; },
+        [](const double* a) -> std::function<void(Image&)> {
+            int size = (int)a[0]; double sigma = a[1];
+            return [=](Image& image) { GaussianFilter::Process(image, size, sigma); };
+        },
+        nullptr },
+    { "gaussiir",  "[:sigma=1.0]",             0, 1, {1.0},
+        // 再帰型は画像全体に依存する (端は延長して扱う)
+        [](const double*) { return FilterGraph::Global; },
+        [](const double* a) -> std::function<void(Image&)> {
+            double sigma = a[0];
+            return [=](Image& image) { GaussianFilter::Process(image, 1, sigma, GaussianFilter::Recursive); };
+        },
+        nullptr },
+    { "bilateral", "[:size=5[:sigma=2.0[:sigma2=30.0]]]", 0, 3, {5, 2.0, 30.0},
+        [](const double* a) { return (int)a[0]/2; },
+        [](const double* a) -> std::function<void(Image&)> {
+            int size = (int)a[0]; double sigma = a[1]; double sigma2 = a[2];
+            return [=](Image& image) { BilateralFilter::Process(image, size, sigma, sigma2); };
+        },
+        nullptr },
+    { "sobel",     "",                         0, 0, {0},
+        [](const double*) { return 1; },
+        [](const double*) -> std::function<void(Image&)> {
+            return [](Image& image) { SobelFilter::Process(image); };
+        },
+        nullptr },
+    { "laplacian", "",                         0, 0, {0},
+        [](const double*) { return 1; },
+        [](const double*) -> std::function<void(Image&)> {
+            return [](Image& image) { LaplacianFilter::Process(image); };
+        },
+        nullptr },
+    { "histeq",    "",                         0, 0, {0},
+        [](const double*) { return FilterGraph::Global; },
+        [](const double*) -> std::function<void(Image&)> {
+            return [](Image& image) { HistgramEqualization::Process(image); };
+        },
+        nullptr },
+    { "clahe",     "[:tile=64[:clip=2.0]]",    0, 2, {64, 2.0},
+        [](const double*) { return FilterGraph::Global; },
+        [](const double* a) -> std::function<void(Image&)> {
+            int tile = (int)a[0]; double clip = a[1];
+            return [=](Image& image) { AdaptiveHistgramEqualization::Process(image, tile, clip); };
+        },
+        nullptr },
+    { "histext",   "",                         0, 0, {0},
+        [](const double*) { return FilterGraph::Global; },
+        nullptr,
+        [](PointPipeline& p, const double*) { p.HistgramExtention(); } },
+    { "gamma",     ":param",                   1, 1, {0},
+        [](const double*) { return 0; },
+        nullptr,
+        [](PointPipeline& p, const double* a) { p.Gamma(a[0]); } },
+    { "logistic",  ":paramA:paramB",           2, 2, {0},
+        [](const double*) { return 0; },
+        nullptr,
+        [](PointPipeline& p, const double* a) { p.Logistic(a[0], a[1]); } },
+};
+
+}
+
+//------------------------------------------------------------------------------
+// 文字列からフィルタチェインを生成する
+//------------------------------------------------------------------------------
+FilterChain::FilterChain(const char* spec) {
+
+    std::stringstream specStream(spec);
+    std::string item;
+
+    // フィルタ本体と halo
+    std::vector<std::function<void(Image&)>> filters;
+    std::vector<int> halos;
+
+    // 直前のフィルタが点処理のときのパイプライン
+    std::shared_ptr<PointPipeline> pipeline;
+
+    // ',' 区切りでフィルタを取り出す
+    while(std::getline(specStream, item, ',')) {
+
+        if(item.empty()) continue;
+
+        // ':' 区切りで名前と引数に分ける
+        std::stringstream itemStream(item);
+        std::string name, arg;
+        std::getline(itemStream, name, ':');
+
+        const FilterEntry* entry = nullptr;
+        for(const auto& e : filterEntries) {
+            if(name == e.name) { entry = &e; break; }
+        }
+        if(entry == nullptr) {
+            std::cerr<<"Error: Unknown Filter \""<<name<<"\""<<std::endl;
+            throw "Filter Chain Parse Error";
+        }
+
+        double args[3] = { entry->defaults[0], entry->defaults[1], entry->defaults[2] };
+        int numArgs = 0;
+        while(std::getline(itemStream, arg, ':')) {
+            char* end = nullptr;
+            double value = strtod(arg.c_str(), &end);
+            if(numArgs >= entry->maxArgs || arg.empty() || *end != '\0') {
+                std::cerr<<"Error: Invalid Argument \""<<item<<"\""<<std::endl;
+                throw "Filter Chain Parse Error";
+            }
+            args[numArgs++] = value;
+        }
+        if(numArgs < entry->minArgs) {
+            std::cerr<<"Error: Too Few Arguments \""<<item<<"\""<<std::endl;
+            throw "Filter Chain Parse Error";
+        }
+
+        int halo = entry->halo(args);
+
+        if(entry->point == nullptr) {
+            filters.push_back(entry->create(args));
+            halos.push_back(halo);
+            pipeline.reset();
+            continue;
+        }
+
+        // 点処理は直前のパイプラインに段を追加する
+        // (HistgramExtention を含むパイプラインは画像全体に依存する)
+        if(!pipeline) {
+            pipeline = std::make_shared<PointPipeline>();
+            std::shared_ptr<const PointPipeline> fused = pipeline;
+            filters.push_back([=](Image& image) { fused->Process(image); });
+            halos.push_back(0);
+        }
+        entry->point(*pipeline, args);
+        if(halo == FilterGraph::Global) halos.back() = FilterGraph::Global;
+    }
+
+    // 局所的なフィルタが続く部分はタイル単位でまとめて適用する
+    for(int i=0; i<(int)filters.size(); i++) {
+        graph.Add(filters[i], halos[i]);
+    }
+}
+
+//------------------------------------------------------------------------------
+// チェインを画像に適用する
+//------------------------------------------------------------------------------
+void FilterChain::Process(Image& image) const {
+    graph.Process(image);
+}
+
+//------------------------------------------------------------------------------
+// 使用できるフィルタの一覧を出力する
+//------------------------------------------------------------------------------
+void FilterChain::PrintUsage() {
+    for(const auto& e : filterEntries) {
+        std::cout<<"    "<<e.name<<e.usage<<std::endl;
+    }
+}
+
+}
@@ -0,0 +1,42 @@
+//==============================================================================
+//
+// フィルタチェイン (文字列で指定したフィルタを順番に適用する)
+//
+//==============================================================================
+#ifndef _MI_FILTER_CHAIN_H_
+#define _MI_FILTER_CHAIN_H_
+
+#include "miImage.h"
+#include "miFilterGraph.h"
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// フィルタチェイン
+//
+// MEMO:
+// "mono,gauss:5:1.0,gamma:2.2" のように ',' 区切りでフィルタを並べ、
+// 引数は ':' 区切りで指定する。解析に失敗した場合は例外を投げる
+// 連続する点処理は1つの PointPipeline にまとめ、チェイン全体は FilterGraph で
+// タイル単位に適用する
+//------------------------------------------------------------------------------
+class FilterChain {
+public:
+    FilterChain(const char* spec);
+
+    // チェインを画像に適用する
+    void Process(Image& image) const;
+
+    // フィルタ数
+    int Size() const { return graph.Size(); }
+
+    // 使用できるフィルタの一覧を出力する
+    static void PrintUsage();
+
+private:
+    FilterGraph graph; // フィルタ本体
+};
+
+}
+
+#endif
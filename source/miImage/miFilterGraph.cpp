@@ -0,0 +1,149 @@
+//==============================================================================
+//
+// フィルタグラフ (複数段のフィルタをタイル単位でまとめて適用する)
+//
+//==============================================================================
+#include "miFilterGraph.h"
+
+#include "miImageProcessing.h"
+
+#include <iostream>
+#include <algorithm>
+#include <thread>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// タイルを分割実行する
+//------------------------------------------------------------------------------
+class TilePass : IImageProcessing {
+public:
+    TilePass(int numTiles, const std::function<void(int, int)>& process) {
+        Processing = process;
+        RunRows(numTiles, std::thread::hardware_concurrency());
+    }
+};
+
+}
+
+//------------------------------------------------------------------------------
+// コンストラクタ
+//------------------------------------------------------------------------------
+FilterGraph::FilterGraph(int tileWidth, int tileHeight)
+    : tileWidth(tileWidth), tileHeight(tileHeight) {
+
+    if(tileWidth < 1 || tileHeight < 1) {
+        std::cerr<<"Error: Invalid Tile Size"<<std::endl;
+        throw "Filter Graph Error";
+    }
+}
+
+//------------------------------------------------------------------------------
+// 段を追加する
+//------------------------------------------------------------------------------
+FilterGraph& FilterGraph::Add(const std::function<void(Image&)>& filter, int halo) {
+
+    if(halo < 0 && halo != Global) {
+        std::cerr<<"Error: Invalid Halo"<<std::endl;
+        throw "Filter Graph Error";
+    }
+
+    stages.push_back({filter, halo});
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+// グラフを画像に適用する
+//------------------------------------------------------------------------------
+void FilterGraph::Process(Image& image) const {
+
+    int begin = 0;
+    while(begin < (int)stages.size()) {
+
+        // Global の段は画像全体に適用する
+        if(stages[begin].halo == Global) {
+            stages[begin].filter(image);
+            begin++;
+            continue;
+        }
+
+        // 次の Global の段までをタイル単位でまとめて適用する
+        int end  = begin;
+        int halo = 0;
+        while(end < (int)stages.size() && stages[end].halo != Global) {
+            halo += stages[end].halo;
+            end++;
+        }
+        ProcessTiles(image, begin, end, halo);
+        begin = end;
+    }
+}
+
+//------------------------------------------------------------------------------
+// 段 [begin, end) をタイル単位で適用する
+// halo: 各段の halo の合計
+//------------------------------------------------------------------------------
+void FilterGraph::ProcessTiles(Image& image, int begin, int end, int halo) const {
+
+    int width  = image.Width();
+    int height = image.Height();
+
+    // 余白の割合が大きくならないよう、タイルは余白の4倍以上にする
+    int tileW = std::max(tileWidth,  4*halo);
+    int tileH = std::max(tileHeight, 4*halo);
+
+    // タイルが1枚で済む場合は画像に直接適用する
+    if(width <= tileW && height <= tileH) {
+        for(int i=begin; i<end; i++) {
+            stages[i].filter(image);
+        }
+        return;
+    }
+
+    int numTilesX = (width  + tileW - 1) / tileW;
+    int numTilesY = (height + tileH - 1) / tileH;
+
+    // 他のタイルの余白として読むため、入力は書き換える前の画像から切り出す
+    const Image source = image;
+
+    TilePass(numTilesX*numTilesY, [&](int startTile, int numTiles) {
+
+        // タイル内のフィルタは1スレッドで処理する
+        SerialScope serial;
+
+        for(int t=startTile; t<startTile+numTiles; t++) {
+
+            // 書き戻す範囲 [x0, x1) x [y0, y1)
+            int x0 = (t % numTilesX) * tileW;
+            int y0 = (t / numTilesX) * tileH;
+            int x1 = std::min(width,  x0 + tileW);
+            int y1 = std::min(height, y0 + tileH);
+
+            // 余白をつけて切り出す範囲 (画像端では画像内に切り詰めるので、
+            // フィルタから見た端は元の画像の端と同じになる)
+            int ex0 = std::max(0, x0 - halo);
+            int ey0 = std::max(0, y0 - halo);
+            int ex1 = std::min(width,  x1 + halo);
+            int ey1 = std::min(height, y1 + halo);
+
+            Image tile(image.Bit(), ex1-ex0, ey1-ey0);
+            for(int iY=ey0; iY<ey1; iY++) {
+                const RGB* src = &source.data[iY*width + ex0];
+                std::copy(src, src + (ex1-ex0), &tile.data[(iY-ey0)*tile.Width()]);
+            }
+
+            for(int i=begin; i<end; i++) {
+                stages[i].filter(tile);
+            }
+
+            for(int iY=y0; iY<y1; iY++) {
+                const RGB* src = &tile.data[(iY-ey0)*tile.Width() + (x0-ex0)];
+                std::copy(src, src + (x1-x0), &image.data[iY*width + x0]);
+            }
+        }
+    });
+}
+
+}
@@ -0,0 +1,61 @@
+//==============================================================================
+//
+// フィルタグラフ (複数段のフィルタをタイル単位でまとめて適用する)
+//
+//==============================================================================
+#ifndef _MI_FILTER_GRAPH_H_
+#define _MI_FILTER_GRAPH_H_
+
+#include "miImage.h"
+#include <vector>
+#include <functional>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// フィルタグラフ
+//
+// MEMO:
+// 段ごとに、出力の1画素が依存する入力の範囲の半径 (halo) を指定して並べる
+// 連続する局所的な段は、画像をタイルに分け、タイルの周囲に各段の halo の合計だけ
+// 余白をつけて切り出し、全段を続けて適用してから余白を除いて書き戻す
+// (中間の画像はタイルの大きさで済むのでキャッシュに載ったまま次の段へ渡せる)
+// タイルはスレッドに分けて並列に処理し、タイル内のフィルタは SerialScope で
+// 1スレッドで処理する
+// ヒストグラムのように画像全体に依存する段 (Global) はタイルに分けず画像全体に適用する
+//------------------------------------------------------------------------------
+class FilterGraph {
+public:
+
+    // 画像全体に依存する段の halo
+    static const int Global = -1;
+
+    FilterGraph(int tileWidth = 256, int tileHeight = 128);
+
+    // 段を追加する
+    FilterGraph& Add(const std::function<void(Image&)>& filter, int halo);
+
+    // グラフを画像に適用する
+    void Process(Image& image) const;
+
+    // 段数
+    int Size() const { return (int)stages.size(); }
+
+private:
+
+    // 段
+    struct Stage {
+        std::function<void(Image&)> filter;
+        int halo;
+    };
+
+    std::vector<Stage> stages;
+    int tileWidth;
+    int tileHeight;
+
+    void ProcessTiles(Image& image, int begin, int end, int halo) const;
+};
+
+}
+
+#endif
@@ -5,7 +5,11 @@
 //==============================================================================
 #include "miImage.h"
 
-#include "miBitmap.h"
+#include "IImageCodec.h"
+#include "miBitmapCodec.h"
+
+#include <iostream>
+#include <fstream>
 
 namespace mi {
 
@@ -45,14 +49,46 @@ Image& Image::operator=(const Image& copied) {
 // 読み込み
 //--------------------------------------------------------------------------
 void Image::Load(const char* fileName) {
+    Read(fileName, nullptr);
+}
+
+void Image::Load(const char* fileName, std::vector<unsigned char>& alpha) {
+    Read(fileName, &alpha);
+}
+
+void Image::Read(const char* fileName, std::vector<unsigned char>* alpha) {
+
+    // ファイルを開く
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file.is_open()) {
+        std::cerr<<"Error: Cant File Open"<<std::endl;
+        throw "File Open Error";
+    }
 
-    Bitmap bitmap(fileName);
+    // ファイルの先頭から形式を判定する
+    const IImageCodec* codec = ImageCodecs::Find(file);
+    if(codec == nullptr) {
+        std::cerr<<"Error: Unknown Image Format"<<std::endl;
+        throw "File Open Error";
+    }
+
+    auto decoder = codec->CreateDecoder();
+    ImageInfo info = decoder->ReadHeader(file);
 
     // 画像のサイズが違ったら再確保
-    if(width != bitmap.Width() || height != bitmap.Height()) {
-        Initialize(bitmap.Bit(), bitmap.Width(), bitmap.Height());
+    if(width != info.width || height != info.height) {
+        Initialize(info.bit, info.width, info.height);
+    }
+    bit = info.bit;
+
+    // 画素データへ直接展開する
+    if(alpha != nullptr) {
+        alpha->resize(size);
+        decoder->ReadRows(0, height, data, alpha->data());
+    }
+    else {
+        decoder->ReadRows(0, height, data);
     }
-    bitmap.CopyToImage(*this);
 }
 
 
@@ -61,12 +97,57 @@ void Image::Load(const char* fileName) {
 //--------------------------------------------------------------------------
 void Image::Save(const char* fileName) {
 
-    Bitmap bitmap(bit, width, height);
-    bitmap.CopyFromImage(*this);
-    bitmap.Write(fileName);
+    // グレースケールならパレットを使って 1/3 の大きさで書き込む
+    int saveBit = IsGrayscale() ? 8 : (bit == 32 ? 32 : 24);
+
+    Save(fileName, saveBit, BitmapCodec::BI_RGB);
+}
+
+void Image::Save(const char* fileName, int bit, int compression) {
+
+    // 拡張子から形式を決める (分からなければ Bitmap)
+    const IImageCodec* codec = ImageCodecs::FindByExtension(fileName);
+    if(codec == nullptr) {
+        static BitmapCodec bitmapCodec;
+        codec = &bitmapCodec;
+    }
+
+    // ファイルを開く
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc | std::ios::out);
+    if(!file.is_open()) {
+        std::cerr<<"Error: Cant File Open"<<std::endl;
+        throw "File Write Error";
+    }
+
+    ImageInfo info;
+    info.bit         = bit;
+    info.width       = width;
+    info.height      = height;
+    info.compression = compression;
+
+    // 画素データから直接書き込む
+    auto encoder = codec->CreateEncoder();
+    encoder->Begin(file, info);
+    encoder->WriteRows(data, height);
+    encoder->End();
 }
     
     
+//--------------------------------------------------------------------------
+// 全画素の RGB が同じ値か
+//
+//   MEMO: カラー画像は最初に違う画素が見つかった時点で終わる
+//--------------------------------------------------------------------------
+bool Image::IsGrayscale() const {
+    for(int i=0; i<size; i++) {
+        if(data[i].r != data[i].g || data[i].r != data[i].b) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
 //--------------------------------------------------------------------------
 // サイズ変更
 //--------------------------------------------------------------------------
@@ -6,6 +6,8 @@
 #ifndef _MI_IMAGE_H_
 #define _MI_IMAGE_H_
 
+#include <vector>
+
 namespace mi {
 
 //------------------------------------------------------------------------------
@@ -61,6 +63,9 @@ struct RGB {
     }
 };
 
+// 画素の配列をバイト列 (R, G, B の繰り返し) として扱うため、詰め物があってはならない
+static_assert(sizeof(RGB) == 3, "RGB must be packed into 3 bytes");
+
 
 //------------------------------------------------------------------------------
 // 画素に[X座標][Y座標]でアクセスするためのクラス
@@ -91,6 +96,8 @@ public:
 };
 
 
+template<class E> class ImageExpression;
+
 //------------------------------------------------------------------------------
 // 汎用画像型
 //------------------------------------------------------------------------------
@@ -110,11 +117,23 @@ public:
     Image(const Image& copied);
     Image& operator=(const Image& copied);
 
+    // 画像の式を評価して代入する (miImageExpression.h)
+    template<class E> Image& operator=(const ImageExpression<E>& expression);
+
     //--------------------------------------------------------------------------
     // 読み込み / 書き込み
     //--------------------------------------------------------------------------
     void Load(const char* fileName);
+
+    // アルファも読み込む (alpha は画素数分の大きさにする, アルファを持たない画像は 255)
+    void Load(const char* fileName, std::vector<unsigned char>& alpha);
+
+    // 全画素の RGB が同じ値なら 8bit グレースケールで書き込み、
+    // そうでなければ 24bit (読み込み時が 32bit なら 32bit) で書き込む
     void Save(const char* fileName);
+
+    // bit数と圧縮形式を指定して書き込む (RLE8 は 8bit, RLE4 は 4bit のみ)
+    void Save(const char* fileName, int bit, int compression);
     
     //--------------------------------------------------------------------------
     // サイズ変更
@@ -130,6 +149,9 @@ public:
     int Height() const { return height; }
     int Size()   const { return size; }
 
+    // 全画素の RGB が同じ値か (モノクロ化などの後)
+    bool IsGrayscale() const;
+
     RGB* Data() { return data; }
     PixelArray2D<RGB>& Pixel() { return pixel; };
 
@@ -138,6 +160,9 @@ private:
     // 初期化する
     void Initialize(int bit, int width, int height);
 
+    // 読み込む (alpha が nullptr でなければアルファも読み込む)
+    void Read(const char* fileName, std::vector<unsigned char>* alpha);
+
     int width  = 0;  // 幅
     int height = 0;  // 高さ
     int size   = 0;  // 画素総数
@@ -0,0 +1,106 @@
+//==============================================================================
+//
+// 画像コーデックの登録と検索
+//
+//==============================================================================
+#include "IImageCodec.h"
+
+#include "miBitmapCodec.h"
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <mutex>
+#include <cstring>
+#include <cctype>
+
+namespace mi {
+
+namespace {
+
+// 登録されているコーデック (Bitmap は最初から登録しておく)
+std::vector<const IImageCodec*>& Codecs() {
+    static BitmapCodec bitmapCodec;
+    static std::vector<const IImageCodec*> codecs(1, &bitmapCodec);
+    return codecs;
+}
+
+std::mutex& CodecsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+}
+
+//------------------------------------------------------------------------------
+// コーデックを登録する
+//------------------------------------------------------------------------------
+void ImageCodecs::Register(const IImageCodec* codec) {
+    std::lock_guard<std::mutex> lock(CodecsMutex());
+    Codecs().push_back(codec);
+}
+
+//------------------------------------------------------------------------------
+// ファイルの先頭からコーデックを探す
+//------------------------------------------------------------------------------
+const IImageCodec* ImageCodecs::Find(const unsigned char* head, int size) {
+    std::lock_guard<std::mutex> lock(CodecsMutex());
+    for(auto codec : Codecs()) {
+        if(codec->Sniff(head, size)) return codec;
+    }
+    return nullptr;
+}
+
+const IImageCodec* ImageCodecs::Find(std::istream& stream) {
+
+    unsigned char head[SniffSize] = {0};
+
+    auto position = stream.tellg();
+    stream.read((char*)head, SniffSize);
+    int size = (int)stream.gcount();
+
+    stream.clear();
+    stream.seekg(position);
+
+    return Find(head, size);
+}
+
+//------------------------------------------------------------------------------
+// ファイル名の拡張子からコーデックを探す (大文字小文字は区別しない)
+//------------------------------------------------------------------------------
+const IImageCodec* ImageCodecs::FindByExtension(const char* fileName) {
+
+    const char* dot = strrchr(fileName, '.');
+    if(dot == nullptr) return nullptr;
+
+    std::lock_guard<std::mutex> lock(CodecsMutex());
+    for(auto codec : Codecs()) {
+        const char* ext = codec->Extension();
+        size_t i = 0;
+        while(ext[i] != '\0' && tolower(dot[i]) == tolower(ext[i])) i++;
+        if(ext[i] == '\0' && dot[i] == '\0') return codec;
+    }
+    return nullptr;
+}
+
+//------------------------------------------------------------------------------
+// ヘッダだけを読み込んで画像の情報を返す
+//------------------------------------------------------------------------------
+ImageInfo ImageCodecs::Probe(const char* fileName) {
+
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file.is_open()) {
+        std::cerr<<"Error: Cant File Open"<<std::endl;
+        throw "File Open Error";
+    }
+
+    const IImageCodec* codec = Find(file);
+    if(codec == nullptr) {
+        std::cerr<<"Error: Unknown Image Format"<<std::endl;
+        throw "File Open Error";
+    }
+
+    return codec->CreateDecoder()->ReadHeader(file);
+}
+
+}
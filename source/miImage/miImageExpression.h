@@ -0,0 +1,293 @@
+//==============================================================================
+//
+// 画像の式 (画素ごとの四則演算を遅延評価する)
+//
+//==============================================================================
+#ifndef _MI_IMAGE_EXPRESSION_H_
+#define _MI_IMAGE_EXPRESSION_H_
+
+#include "miImage.h"
+#include "miImageProcessing.h"
+
+#include <iostream>
+#include <thread>
+#include <cstring>
+#include <type_traits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 画像の式
+//
+// MEMO:
+// out = a * 0.3 + b * 0.7 - c のように Image と数値を四則演算でつなぐと、
+// 計算はせずに式の木 (値として持つ) を作り、Image に代入するときに
+// 画素のチャンネルごとに float で評価して、0..255 に飽和・丸めて書き込む
+// (途中で unsigned char に切り捨てないので RGB の演算子より誤差が小さく、
+//  式全体を1回の走査で並列に評価する)
+// 式が参照する Image は代入が終わるまで生きていること
+// 同じ位置の画素しか参照しないので、代入先が式に含まれていてもよい
+// 各項は1チャンネルを返す Eval と、SSE2 では連続する4チャンネルを返す Eval4 を持つ
+//------------------------------------------------------------------------------
+template<class E>
+class ImageExpression {
+public:
+    const E& Derived() const { return static_cast<const E&>(*this); }
+};
+
+namespace ExpressionDetail {
+
+//------------------------------------------------------------------------------
+// 式の葉 (画像)
+//------------------------------------------------------------------------------
+class ImageTerm : public ImageExpression<ImageTerm> {
+public:
+    ImageTerm(const Image& image) : image(&image), data((const unsigned char*)image.data) {}
+
+    // j 番目のチャンネルの値 (data を unsigned char の列とみたときの位置)
+    float Eval(int j) const { return data[j]; }
+#ifdef __SSE2__
+    __m128 Eval4(int j) const {
+        int packed;
+        memcpy(&packed, &data[j], 4);
+        __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), _mm_setzero_si128());
+        return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, _mm_setzero_si128()));
+    }
+#endif
+
+    // 式に含まれる画像 (大きさの確認用)
+    const Image* Shape() const { return image; }
+    bool Matches(const Image& shape) const {
+        return image->Width() == shape.Width() && image->Height() == shape.Height();
+    }
+
+private:
+    const Image* image;
+    const unsigned char* data;
+};
+
+//------------------------------------------------------------------------------
+// 式の葉 (数値)
+//------------------------------------------------------------------------------
+class ScalarTerm : public ImageExpression<ScalarTerm> {
+public:
+    ScalarTerm(float value) : value(value) {}
+
+    float Eval(int) const { return value; }
+#ifdef __SSE2__
+    __m128 Eval4(int) const { return _mm_set1_ps(value); }
+#endif
+
+    const Image* Shape() const { return nullptr; }
+    bool Matches(const Image&) const { return true; }
+
+private:
+    float value;
+};
+
+//------------------------------------------------------------------------------
+// 二項演算
+//------------------------------------------------------------------------------
+struct Add {
+    static float Apply(float a, float b) { return a + b; }
+#ifdef __SSE2__
+    static __m128 Apply(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+#endif
+};
+struct Subtract {
+    static float Apply(float a, float b) { return a - b; }
+#ifdef __SSE2__
+    static __m128 Apply(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+#endif
+};
+struct Multiply {
+    static float Apply(float a, float b) { return a * b; }
+#ifdef __SSE2__
+    static __m128 Apply(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+#endif
+};
+struct Divide {
+    static float Apply(float a, float b) { return a / b; }
+#ifdef __SSE2__
+    static __m128 Apply(__m128 a, __m128 b) { return _mm_div_ps(a, b); }
+#endif
+};
+
+template<class Op, class L, class R>
+class BinaryTerm : public ImageExpression<BinaryTerm<Op, L, R>> {
+public:
+    BinaryTerm(const L& left, const R& right) : left(left), right(right) {}
+
+    float Eval(int j) const { return Op::Apply(left.Eval(j), right.Eval(j)); }
+#ifdef __SSE2__
+    __m128 Eval4(int j) const { return Op::Apply(left.Eval4(j), right.Eval4(j)); }
+#endif
+
+    const Image* Shape() const {
+        return (left.Shape() != nullptr) ? left.Shape() : right.Shape();
+    }
+    bool Matches(const Image& shape) const {
+        return left.Matches(shape) && right.Matches(shape);
+    }
+
+private:
+    L left;
+    R right;
+};
+
+//------------------------------------------------------------------------------
+// 演算子の引数を式の項に変換する
+//------------------------------------------------------------------------------
+template<class T>
+struct IsImageOperand : std::integral_constant<bool,
+    std::is_same<T, Image>::value || std::is_base_of<ImageExpression<T>, T>::value> {};
+
+template<class T>
+struct IsOperand : std::integral_constant<bool,
+    IsImageOperand<T>::value || std::is_arithmetic<T>::value> {};
+
+template<class T, class Enable = void>
+struct Term;
+
+template<>
+struct Term<Image> {
+    typedef ImageTerm Type;
+    static Type Make(const Image& image) { return Type(image); }
+};
+
+template<class T>
+struct Term<T, typename std::enable_if<std::is_arithmetic<T>::value>::type> {
+    typedef ScalarTerm Type;
+    static Type Make(T value) { return Type((float)value); }
+};
+
+template<class T>
+struct Term<T, typename std::enable_if<std::is_base_of<ImageExpression<T>, T>::value>::type> {
+    typedef T Type;
+    static const Type& Make(const T& expression) { return expression; }
+};
+
+// 少なくとも片方が画像か式のときだけ演算子を有効にする
+template<class Op, class L, class R,
+         bool = IsOperand<L>::value && IsOperand<R>::value &&
+                (IsImageOperand<L>::value || IsImageOperand<R>::value)>
+struct BinaryResult {};
+
+template<class Op, class L, class R>
+struct BinaryResult<Op, L, R, true> {
+    typedef BinaryTerm<Op, typename Term<L>::Type, typename Term<R>::Type> Type;
+    static Type Make(const L& left, const R& right) {
+        return Type(Term<L>::Make(left), Term<R>::Make(right));
+    }
+};
+
+//------------------------------------------------------------------------------
+// チャンネル [begin, end) に式を評価して書き込む
+// (0..255 に飽和させて丸める, NaN は 0)
+//
+// MEMO:
+// float の比較による飽和は自動ベクトル化されないので、SSE2 では16チャンネルずつ
+// Eval4 で評価して minps/maxps で飽和させ、パックして書き込む
+//------------------------------------------------------------------------------
+template<class E>
+void AssignRange(unsigned char* dst, const E& expression, int begin, int end) {
+    
+    int j = begin;
+    
+#ifdef __SSE2__
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 full = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    for(; j+16<=end; j+=16) {
+        __m128i v[4];
+        for(int k=0; k<4; k++) {
+            // maxps は NaN のとき第2引数を返すので NaN は 0 になる
+            __m128 value = _mm_min_ps(_mm_max_ps(expression.Eval4(j+k*4), zero), full);
+            v[k] = _mm_cvttps_epi32(_mm_add_ps(value, half));
+        }
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+        _mm_storeu_si128((__m128i*)&dst[j], packed);
+    }
+#endif
+    
+    for(; j<end; j++) {
+        float value = expression.Eval(j);
+        value = (value > 0.0f)   ? value : 0.0f; // NaN も 0 にする
+        value = (value < 255.0f) ? value : 255.0f;
+        dst[j] = (unsigned char)(value + 0.5f);
+    }
+}
+
+//------------------------------------------------------------------------------
+// 式を画像に代入する (画素を分割して並列に評価する)
+//------------------------------------------------------------------------------
+template<class E>
+class Assignment : IImageProcessing {
+public:
+    Assignment(Image& image, const E& expression) {
+        Processing = [&](int start, int length) {
+            AssignRange((unsigned char*)image.data, expression, start*3, (start+length)*3);
+        };
+        Run(image, std::thread::hardware_concurrency());
+    }
+};
+
+}
+
+//------------------------------------------------------------------------------
+// 演算子
+//------------------------------------------------------------------------------
+template<class L, class R>
+typename ExpressionDetail::BinaryResult<ExpressionDetail::Add, L, R>::Type
+operator+(const L& left, const R& right) {
+    return ExpressionDetail::BinaryResult<ExpressionDetail::Add, L, R>::Make(left, right);
+}
+
+template<class L, class R>
+typename ExpressionDetail::BinaryResult<ExpressionDetail::Subtract, L, R>::Type
+operator-(const L& left, const R& right) {
+    return ExpressionDetail::BinaryResult<ExpressionDetail::Subtract, L, R>::Make(left, right);
+}
+
+template<class L, class R>
+typename ExpressionDetail::BinaryResult<ExpressionDetail::Multiply, L, R>::Type
+operator*(const L& left, const R& right) {
+    return ExpressionDetail::BinaryResult<ExpressionDetail::Multiply, L, R>::Make(left, right);
+}
+
+template<class L, class R>
+typename ExpressionDetail::BinaryResult<ExpressionDetail::Divide, L, R>::Type
+operator/(const L& left, const R& right) {
+    return ExpressionDetail::BinaryResult<ExpressionDetail::Divide, L, R>::Make(left, right);
+}
+
+//------------------------------------------------------------------------------
+// 式を評価して代入する
+// (代入先の大きさが式の画像と違う場合は、式の画像の大きさで作り直す)
+//------------------------------------------------------------------------------
+template<class E>
+Image& Image::operator=(const ImageExpression<E>& expression) {
+
+    const E& derived = expression.Derived();
+    const Image* shape = derived.Shape();
+
+    if(!derived.Matches(*shape)) {
+        std::cerr<<"Error: Image Size Mismatch"<<std::endl;
+        throw "Image Expression Error";
+    }
+
+    if(Width() != shape->Width() || Height() != shape->Height()) {
+        Initialize(shape->Bit(), shape->Width(), shape->Height());
+    }
+
+    ExpressionDetail::Assignment<E> assignment(*this, derived);
+    return *this;
+}
+
+}
+
+#endif
@@ -4,14 +4,49 @@
 //
 //==============================================================================
 #include "miImageProcessing.h"
+#include "miIntegralImage.h"
+#include "miConvolution.h"
+#include "miNeighborhood.h"
+#include "miPointPipeline.h"
+#include "miLuma.h"
+#include "miKernels.h"
+#include "miImageStatistics.h"
 
+#include <iostream>
 #include <thread>
 #include <functional>
 #include <algorithm>
 #include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace mi {
 
+namespace {
+
+// このスレッドが SerialScope の中か
+thread_local bool serialScopeActive = false;
+
+}
+
+//------------------------------------------------------------------------------
+// フィルタ内部の並列化を止めるスコープ
+//------------------------------------------------------------------------------
+SerialScope::SerialScope() : previous(serialScopeActive) {
+    serialScopeActive = true;
+}
+
+SerialScope::~SerialScope() {
+    serialScopeActive = previous;
+}
+
+bool SerialScope::IsActive() {
+    return serialScopeActive;
+}
+
 //------------------------------------------------------------------------------
 // 画像処理を分割実行する
 // image     : 処理する画像
@@ -19,6 +54,12 @@ namespace mi {
 //------------------------------------------------------------------------------
 void IImageProcessing::Run(Image& image, int numThreads) {
     
+    // SerialScope の中では呼び出したスレッドで処理する
+    if(SerialScope::IsActive()) {
+        Processing(0, image.Size());
+        return;
+    }
+    
     // データが指定スレッド数より少ない場合は1スレッドで処理する(処理が競合するのを防ぐ)
     if(numThreads > image.Size()) {
         numThreads = 1;
@@ -28,9 +69,11 @@ void IImageProcessing::Run(Image& image, int numThreads) {
     std::thread* threads = new std::thread[numThreads];
     
     // スレッドを生成して画像処理を実行する
+    // (割り切れない残りは最後のスレッドで処理する)
     for(int i=0; i<numThreads; i++){
         int length = image.Size() / numThreads;
         int start  = i*length;
+        if(i == numThreads-1) length = image.Size() - start;
         threads[i] = std::thread(Processing,start,length);
     }
     
@@ -44,23 +87,66 @@ void IImageProcessing::Run(Image& image, int numThreads) {
 }
 
 //------------------------------------------------------------------------------
-// モノクロ処理
+// 画像処理を行単位で分割実行する
+// image     : 処理する画像
+// numThreads: スレッド数
 //------------------------------------------------------------------------------
-Monochrome::Monochrome(Image& image) {
+void IImageProcessing::RunRows(Image& image, int numThreads) {
+    RunRows(image.Height(), numThreads);
+}
+
+void IImageProcessing::RunRows(int numRows, int numThreads) {
     
-    // 画像処理本体
-    Processing = [&](int start, int length) {
-        
-        for(int i=start; i<start+length; i++) {
-            int Y = (int)(0.299*image.data[i].r + 0.587*image.data[i].g + 0.114*image.data[i].b);
-            image.data[i].r = (unsigned char)Y;
-            image.data[i].g = (unsigned char)Y;
-            image.data[i].b = (unsigned char)Y;
-        }
-    };
+    // SerialScope の中では呼び出したスレッドで処理する
+    if(SerialScope::IsActive()) {
+        Processing(0, numRows);
+        return;
+    }
     
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    // 行数が指定スレッド数より少ない場合は行数に合わせる
+    if(numThreads > numRows) {
+        numThreads = numRows;
+    }
+    if(numThreads < 1) {
+        numThreads = 1;
+    }
+    
+    // スレッドオブジェクトを生成
+    std::thread* threads = new std::thread[numThreads];
+    
+    // スレッドを生成して画像処理を実行する
+    // (割り切れない残りは先頭のスレッドから1行ずつ割り振る)
+    int startRow = 0;
+    for(int i=0; i<numThreads; i++){
+        int length = numRows / numThreads + (i < numRows % numThreads ? 1 : 0);
+        threads[i] = std::thread(Processing,startRow,length);
+        startRow += length;
+    }
+    
+    // 各スレッドの終了処理
+    for(int i=0; i<numThreads; i++){
+        threads[i].join();
+    }
+    
+    // スレッドオブジェクトを破棄
+    delete[] threads;
+}
+
+//------------------------------------------------------------------------------
+// 値の差に対する重みの参照テーブル
+//------------------------------------------------------------------------------
+RangeWeightTable::RangeWeightTable(double sig2) {
+    for(int i=0; i<511; i++) {
+        double d = i - 255;
+        table[i] = exp( -d*d / sig2 );
+    }
+}
+
+//------------------------------------------------------------------------------
+// モノクロ処理
+//------------------------------------------------------------------------------
+Monochrome::Monochrome(Image& image) {
+    PointPipeline().Monochrome().Process(image);
 }
     
 //------------------------------------------------------------------------------
@@ -75,7 +161,7 @@ DitheringErrorDiffusion::DitheringErrorDiffusion(Image& image) {
             int iX = i % image.Width();
             int iY = i / image.Width();
 
-            int Y = (int)(0.299*image.data[i].r + 0.587*image.data[i].g + 0.114*image.data[i].b);
+            int Y = Luma(image.data[i]);
             
             if(Y > 127) image.pixel[iX][iY] = RGB(255,255,255);
             else        image.pixel[iX][iY] = RGB(0,0,0);
@@ -105,13 +191,38 @@ DitheringErrorDiffusion::DitheringErrorDiffusion(Image& image) {
 // 2値化処理
 //------------------------------------------------------------------------------
 Binarize::Binarize(Image &image, int threshold) {
+    PointPipeline().Binarize(threshold).Process(image);
+}
 
+//------------------------------------------------------------------------------
+// 適応的2値化処理 (Sauvola)
+//------------------------------------------------------------------------------
+AdaptiveBinarize::AdaptiveBinarize(Image& image, int filterSize, double k) {
+    
+    // 輝度の積分画像 (2乗和も作る)
+    Image mono = image;
+    Monochrome::Process(mono);
+    IntegralImage integral(mono, true);
+    
+    // 注目画素からの窓の範囲
+    int lo = -(filterSize/2);
+    int hi = filterSize - 1 + lo;
+    
     // 画像処理本体
     Processing = [&](int start, int length) {
         
         for(int i=start; i<start+length; i++) {
-            int Y = (int)(0.299*image.data[i].r + 0.587*image.data[i].g + 0.114*image.data[i].b);
-            if(Y > threshold) {
+            int iX = i % image.Width();
+            int iY = i / image.Width();
+            
+            int x0 = iX+lo, y0 = iY+lo, x1 = iX+hi+1, y1 = iY+hi+1;
+            double count    = integral.Count(x0, y0, x1, y1);
+            double mean     = integral.Sum(x0, y0, x1, y1).r / count;
+            double variance = integral.SquaredSum(x0, y0, x1, y1).r / count - mean*mean;
+            double deviation = sqrt(std::max(0.0, variance));
+            
+            double threshold = mean * (1.0 + k * (deviation / 128.0 - 1.0));
+            if(mono.data[i].r > threshold) {
                 image.data[i] = RGB(255,255,255);
             }
             else {
@@ -129,196 +240,613 @@ Binarize::Binarize(Image &image, int threshold) {
 //------------------------------------------------------------------------------
 MedianFilter::MedianFilter(Image& image, int filterSize) {
     
+    if(filterSize == 3) {
+        ProcessNetwork<3>(image);
+    }
+    else if(filterSize == 5) {
+        ProcessNetwork<5>(image);
+    }
+    // ヒストグラムの度数は16bitなので 255 までとする
+    else if(filterSize >= HistgramThreshold && filterSize <= 255) {
+        ProcessHistgram(image, filterSize);
+    }
+    else {
+        ProcessSort(image, filterSize);
+    }
+}
+
+//------------------------------------------------------------------------------
+// メディアンフィルタ (ソート)
+//------------------------------------------------------------------------------
+void MedianFilter::ProcessSort(Image& image, int filterSize) {
+    
+    int width = image.Width();
+    Neighborhood region(width, image.Height(), filterSize);
+    
     // コピー
     Image copy = image;
     
-    // 画像処理本体
-    Processing = [&](int start, int length) {
+    // 画像処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows) {
         
-        int halfSize = filterSize/2;
-        int sqrSize  = filterSize*filterSize;
+        int sqrSize = filterSize*filterSize;
         
-        int* R = new int[sqrSize];
-        int* G = new int[sqrSize];
-        int* B = new int[sqrSize];
-
-        for(int i=start; i<start+length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
-
+        std::vector<int> R(sqrSize);
+        std::vector<int> G(sqrSize);
+        std::vector<int> B(sqrSize);
+        
+        // 画像内の窓 [x0, x1] x [y0, y1] の中央値
+        auto median = [&](int iX, int iY, int x0, int y0, int x1, int y1) {
+            
             int pixelCount = 0;
-
-            for(int j=0; j<sqrSize; j++){
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
-                    
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
-                
-                R[pixelCount] = copy.pixel[jX][jY].r;
-                G[pixelCount] = copy.pixel[jX][jY].g;
-                B[pixelCount] = copy.pixel[jX][jY].b;
-                pixelCount++;
+            
+            for(int jY=y0; jY<=y1; jY++) {
+                const RGB* row = &copy.data[jY*width];
+                for(int jX=x0; jX<=x1; jX++) {
+                    R[pixelCount] = row[jX].r;
+                    G[pixelCount] = row[jX].g;
+                    B[pixelCount] = row[jX].b;
+                    pixelCount++;
+                }
             }
             
-            std::sort(R, R+pixelCount);
-            std::sort(G, G+pixelCount);
-            std::sort(B, B+pixelCount);
+            std::sort(R.begin(), R.begin()+pixelCount);
+            std::sort(G.begin(), G.begin()+pixelCount);
+            std::sort(B.begin(), B.begin()+pixelCount);
             
-            image.pixel[iX][iY].r = R[pixelCount/2];
-            image.pixel[iX][iY].g = G[pixelCount/2];
-            image.pixel[iX][iY].b = B[pixelCount/2];
-        }
+            image.data[iY*width + iX] = RGB(R[pixelCount/2], G[pixelCount/2], B[pixelCount/2]);
+        };
         
-        delete[] R;
-        delete[] G;
-        delete[] B;
+        region.ForEachWindow(startRow, numRows, median);
     };
     
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
 }
     
 //------------------------------------------------------------------------------
-// 平均化フィルタ
+// メディアンフィルタ (ヒストグラム)
+//
+// MEMO:
+// 列ごとに縦 filterSize 画素分のヒストグラムを持ち、行を進めるときは
+// 1画素ずつ出し入れする。カーネルのヒストグラムは列ヒストグラムの和で、
+// 横に進めるときは列ヒストグラムを1本ずつ足し引きする
+// 中央値は16階級の粗いヒストグラムで範囲を絞ってから探す
+// 画像端ではソート版と同じく画像内の画素だけで中央値を求める
 //------------------------------------------------------------------------------
-AverageFilter::AverageFilter(Image& image, int filterSize) {
+namespace {
 
-    int halfSize = filterSize/2;
-    
-    // 縦横の走査をわけるための値
-    int horizontal = 0; // 横方向走査時には1, そうでなければ0
-    int vertical   = 0; // 縦方向走査時には1, そうでなければ0
+struct MedianHistgram {
+    unsigned short coarse[16];
+    unsigned short fine[256];
+};
+
+inline void AddHistgram(MedianHistgram& dst, const MedianHistgram& src) {
+    for(int i=0; i<16;  i++) dst.coarse[i] += src.coarse[i];
+    for(int i=0; i<256; i++) dst.fine[i]   += src.fine[i];
+}
+
+inline void SubHistgram(MedianHistgram& dst, const MedianHistgram& src) {
+    for(int i=0; i<16;  i++) dst.coarse[i] -= src.coarse[i];
+    for(int i=0; i<256; i++) dst.fine[i]   -= src.fine[i];
+}
+
+// 小さい方から数えて rank 番目 (0始まり) の値を求める
+inline unsigned char FindRank(const MedianHistgram& histgram, int rank) {
+    int sum = 0;
+    int c = 0;
+    while(sum + histgram.coarse[c] <= rank) {
+        sum += histgram.coarse[c++];
+    }
+    int v = c*16;
+    while(true) {
+        sum += histgram.fine[v];
+        if(sum > rank) break;
+        v++;
+    }
+    return (unsigned char)v;
+}
+
+}
+
+void MedianFilter::ProcessHistgram(Image& image, int filterSize) {
     
-    // 宣言
-    Image copy(image.Bit(), image.Width(), image.Height());
+    // コピー
+    Image copy = image;
     
-    // 処理本体
-    Processing = [&](int start, int length){
+    // 画像処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows) {
         
-        for(int i=start; i<start + length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        int width  = image.Width();
+        int height = image.Height();
+        
+        // 注目画素からのカーネルの範囲 (ソート版と同じく偶数サイズでは前寄り)
+        int lo = -(filterSize/2);
+        int hi = filterSize - 1 + lo;
+        
+        // 列ヒストグラム (列ごとに R,G,B の順)
+        std::vector<MedianHistgram> columns(width*3);
+        
+        auto addRow = [&](int y, int sign) {
+            const RGB* src = &copy.data[y*width];
+            for(int x=0; x<width; x++) {
+                MedianHistgram* column = &columns[x*3];
+                column[0].coarse[src[x].r>>4] += sign; column[0].fine[src[x].r] += sign;
+                column[1].coarse[src[x].g>>4] += sign; column[1].fine[src[x].g] += sign;
+                column[2].coarse[src[x].b>>4] += sign; column[2].fine[src[x].b] += sign;
+            }
+        };
+        
+        // 開始行のカーネルに含まれる行を積む
+        for(int y=std::max(0,startRow+lo); y<=std::min(height-1,startRow+hi); y++) {
+            addRow(y, 1);
+        }
+        
+        for(int iY=startRow; iY<startRow+numRows; iY++) {
+            
+            // 列ヒストグラムを1行下へずらす
+            if(iY > startRow) {
+                if(iY-1+lo >= 0)   addRow(iY-1+lo, -1);
+                if(iY+hi < height) addRow(iY+hi, 1);
+            }
+            int rows = std::min(height-1,iY+hi) - std::max(0,iY+lo) + 1;
             
-            double R=0, G=0, B=0;
+            // 左端のカーネルヒストグラム
+            MedianHistgram kernel[3] = {};
+            for(int x=std::max(0,lo); x<=std::min(width-1,hi); x++) {
+                for(int c=0; c<3; c++) AddHistgram(kernel[c], columns[x*3+c]);
+            }
             
-            for(int j=0; j<filterSize; j++) {
-                int jX = iX + (j-halfSize) * horizontal;
-                int jY = iY + (j-halfSize) * vertical;
+            RGB* dst = &image.data[iY*width];
+            for(int iX=0; iX<width; iX++) {
                 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+                // カーネルヒストグラムを1列右へずらす
+                if(iX > 0) {
+                    if(iX-1+lo >= 0) {
+                        for(int c=0; c<3; c++) SubHistgram(kernel[c], columns[(iX-1+lo)*3+c]);
+                    }
+                    if(iX+hi < width) {
+                        for(int c=0; c<3; c++) AddHistgram(kernel[c], columns[(iX+hi)*3+c]);
+                    }
+                }
+                int cols = std::min(width-1,iX+hi) - std::max(0,iX+lo) + 1;
                 
-                R += copy.pixel[jX][iY].r;
-                G += copy.pixel[jX][iY].g;
-                B += copy.pixel[jX][iY].b;
+                int rank = rows*cols/2;
+                dst[iX].r = FindRank(kernel[0], rank);
+                dst[iX].g = FindRank(kernel[1], rank);
+                dst[iX].b = FindRank(kernel[2], rank);
             }
-            
-            image.pixel[iX][iY] = RGB(R/filterSize, G/filterSize, B/filterSize);
         }
     };
-
-    // 横方向 ----
+    
+    // Processingの処理をおこなう
+    RunRows(image, std::thread::hardware_concurrency());
+}
+    
+//------------------------------------------------------------------------------
+// メディアンフィルタ (ソーティングネットワーク)
+//
+// MEMO:
+// 3x3, 5x5 専用。まず縦方向の Size 画素を列ごとにソートしておき (横に並ぶ
+// Size 画素で共有できる)、ソート済みの列 Size 本から中央値を選ぶネットワークを
+// 通す。ネットワークは min/max だけなので分岐がなく、RGB のバイト列をそのまま
+// 16バイトずつ SSE2 で処理できる (隣の画素は ±3 バイト先)
+// ネットワーク本体は命令セットごとのカーネル表にある (miKernels.inl)
+// カーネルが画像からはみ出す端の画素はソート版と同じ方法で処理する
+//------------------------------------------------------------------------------
+template<int Size>
+void MedianFilter::ProcessNetwork(Image& image) {
+    
+    const int half = Size/2;
+    
     // コピー
-    std::copy(image.data, image.data+image.Size(), copy.data);
+    Image copy = image;
+    
+    // 使用するネットワーク
+    const Kernels& kernels = CurrentKernels();
+    auto sortColumns   = (Size == 3) ? kernels.sortColumns3   : kernels.sortColumns5;
+    auto selectMedians = (Size == 3) ? kernels.selectMedians3 : kernels.selectMedians5;
     
-    // 横方向
-    horizontal = 1;
-    vertical   = 0;
+    // 画像処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows) {
+        
+        int width  = image.Width();
+        int stride = width*3;
+        Neighborhood region(width, image.Height(), Size);
         
+        // 画像内の画素だけで中央値を求める (端の画素用)
+        auto border = [&](int iX, int iY) {
+            unsigned char R[Size*Size], G[Size*Size], B[Size*Size];
+            int pixelCount = 0;
+            int x0, y0, x1, y1;
+            region.Clip(iX, iY, x0, y0, x1, y1);
+            for(int jY=y0; jY<=y1; jY++) {
+                for(int jX=x0; jX<=x1; jX++) {
+                    R[pixelCount] = copy.data[jY*width + jX].r;
+                    G[pixelCount] = copy.data[jY*width + jX].g;
+                    B[pixelCount] = copy.data[jY*width + jX].b;
+                    pixelCount++;
+                }
+            }
+            std::nth_element(R, R+pixelCount/2, R+pixelCount);
+            std::nth_element(G, G+pixelCount/2, G+pixelCount);
+            std::nth_element(B, B+pixelCount/2, B+pixelCount);
+            image.pixel[iX][iY] = RGB(R[pixelCount/2], G[pixelCount/2], B[pixelCount/2]);
+        };
+        
+        // 列をソートした値 (1行分 x Size)
+        std::vector<unsigned char> buffer(stride*Size);
+        unsigned char* sorted[Size];
+        for(int k=0; k<Size; k++) sorted[k] = &buffer[stride*k];
+        
+        // 内側の行は列ごとにソートしてから中央値を選ぶ
+        auto interior = [&](int iY, int begin, int end) {
+            const unsigned char* src[Size];
+            for(int k=0; k<Size; k++) src[k] = (const unsigned char*)&copy.data[(iY-half+k)*width];
+            
+            sortColumns(src, sorted, 0, stride);
+            selectMedians(sorted, (unsigned char*)&image.data[iY*width], begin*3, end*3);
+        };
+        
+        region.ForEachRow(startRow, numRows, interior, border);
+    };
+    
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
+}
     
+
+//------------------------------------------------------------------------------
+// 平均化フィルタ
+//
+// MEMO:
+// 畳み込みエンジンの箱型カーネルで窓の合計を求めるので、1画素あたりの
+// 計算量は filterSize に依存しない
+// 画像端では画像内の画素数で割る
+//------------------------------------------------------------------------------
+AverageFilter::AverageFilter(Image& image, int filterSize) {
     
-    // 縦方向 ----
-    // コピー
-    std::copy(image.data, image.data+image.Size(), copy.data);
+    int width = image.Width();
     
-    // 縦方向
-    horizontal = 0;
-    vertical   = 1;
+    // 宣言
+    Image copy = image;
+    Plane<unsigned char> src = MakePlane(copy);
+    BoxKernel kernel = {filterSize, filterSize};
+    const Kernels& kernels = CurrentKernels();
+    
+    // 画像処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows) {
+        ConvolveRows<BorderPolicy::Renormalize, int>(src, kernel, startRow, numRows,
+            [&](int iY, const int* sums, const int* counts) {
+                kernels.averageRow(sums, counts, (unsigned char*)&image.data[iY*width], width);
+            });
+    };
         
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
 }
 
 //------------------------------------------------------------------------------
 // Gaussian フィルタ
 //------------------------------------------------------------------------------
-GaussianFilter::GaussianFilter(Image& image, int filterSize, double sigma) {
+GaussianFilter::GaussianFilter(Image& image, int filterSize, double sigma, Mode mode) {
     
-    int halfSize = filterSize/2;
+    // Auto で Recursive を選ぶと端の扱いが変わり、マスクの幅によって端付近の結果が
+    // 不連続に変わるため、Auto は常に FixedPoint にする
+    if(mode == Auto) {
+        mode = FixedPoint;
+    }
     
-    // マスクの生成
-    double* LUT = new double[filterSize];
-    double  DIV = 0;
+    if(mode == Recursive) {
+        ProcessRecursive(image, sigma);
+    }
+    else if(mode == FixedPoint) {
+        ProcessFixedPoint(image, filterSize, sigma);
+    }
+    else {
+        ProcessReference(image, filterSize, sigma);
+    }
+}
+
+namespace {
+
+// Gaussian フィルタの横方向のマスク (合計が 1 になるよう正規化する)
+DynamicKernel<double> GaussianMask(int filterSize, double sigma) {
+    
+    int halfSize = filterSize/2;
+    DynamicKernel<double> mask(filterSize, 1);
+    double DIV = 0;
     
     for(int i=0; i<filterSize; i++) {
         int j = i - halfSize;
-        LUT[i] = exp( -j*j / sigma );
-        DIV += LUT[i];
+        mask[i] = exp( -j*j / sigma );
+        DIV += mask[i];
     }
     for(int i=0; i<filterSize; i++) {
-        LUT[i] /= DIV;
+        mask[i] /= DIV;
     }
+    return mask;
+}
+
+// 横方向に double で畳み込み、切り捨てた値を store(iY, p, value) に渡す
+// (Reference と FixedPoint で同じ横方向の結果になるよう共通にしている)
+template<class Store>
+void GaussianHorizontal(const Plane<unsigned char>& src, const DynamicKernel<double>& mask,
+                        int startRow, int numRows, Store store) {
+    int stride = src.width*src.channels;
+    ConvolveRows<BorderPolicy::Zero, double>(src, mask, startRow, numRows,
+        [&](int iY, const double* sums, const double*) {
+            for(int p=0; p<stride; p++) {
+                store(iY, p, (unsigned char)sums[p]);
+            }
+        });
+}
+
+}
+
+//------------------------------------------------------------------------------
+// Gaussian フィルタ (double で畳み込む)
+//------------------------------------------------------------------------------
+void GaussianFilter::ProcessReference(Image& image, int filterSize, double sigma) {
+    
+    int width = image.Width();
     
-    // 縦横の走査をわけるための値
-    int horizontal = 0; // 横方向走査時には1, そうでなければ0
-    int vertical   = 0; // 縦方向走査時には1, そうでなければ0
+    // マスクの生成 (横方向と縦方向)
+    DynamicKernel<double> horizontal = GaussianMask(filterSize, sigma);
+    DynamicKernel<double> vertical(1, filterSize);
+    vertical.weights = horizontal.weights;
     
     // 宣言
     Image copy(image.Bit(), image.Width(), image.Height());
+    Plane<unsigned char> src = MakePlane(copy);
     
-    // 処理本体
-    Processing = [&](int start, int length){
+    // 横方向 (画像外のマスクは捨てる)
+    std::copy(image.data, image.data+image.Size(), copy.data);
+    Processing = [&](int startRow, int numRows){
+        GaussianHorizontal(src, horizontal, startRow, numRows, [&](int iY, int p, unsigned char value) {
+            ((unsigned char*)&image.data[iY*width])[p] = value;
+        });
+    };
+    RunRows(image, std::thread::hardware_concurrency());
+    
+    // 縦方向
+    std::copy(image.data, image.data+image.Size(), copy.data);
+    Processing = [&](int startRow, int numRows){
+        ConvolveRows<BorderPolicy::Zero, double>(src, vertical, startRow, numRows,
+            [&](int iY, const double* sums, const double*) {
+                std::transform(sums, sums+width*3, (unsigned char*)&image.data[iY*width],
+                               [](double sum) { return (unsigned char)sum; });
+            });
+    };
+    RunRows(image, std::thread::hardware_concurrency());
+}
+    
+//------------------------------------------------------------------------------
+// Gaussian フィルタ (固定小数点)
+//
+// MEMO:
+// 横方向は Reference と同じく double で畳み込んで切り捨てる (結果は Reference と一致する)
+// 縦方向はマスクを 2^14 倍した16bit整数にして、隣り合う2タップを並べて pmaddwd で
+// 積和をとり、2^14 で割って切り捨てる
+// マスクの量子化の誤差は 1 未満なので、結果と Reference の差は ±1 以内になる
+// 画像外のタップは Reference と同じく捨てる (0 とみなす)
+// 縦方向の畳み込みは命令セットごとのカーネル表にある (miKernels.inl)
+//------------------------------------------------------------------------------
+void GaussianFilter::ProcessFixedPoint(Image& image, int filterSize, double sigma) {
+    
+    int halfSize = filterSize/2;
+    int width  = image.Width();
+    int height = image.Height();
+    int stride = width*3;
+    int numThreads = std::thread::hardware_concurrency();
+    const Kernels& kernels = CurrentKernels();
+    
+    // マスクの生成 (Reference と同じ値を 2^14 倍して丸め、合計が 2^14 になるよう中央で調整する)
+    DynamicKernel<double> mask = GaussianMask(filterSize, sigma);
+    std::vector<short> weights(filterSize);
+    int total = 0;
+    for(int i=0; i<filterSize; i++) {
+        weights[i] = (short)floor(mask[i] * (1 << GaussianWeightBits) + 0.5);
+        total += weights[i];
+    }
+    weights[halfSize] += (short)((1 << GaussianWeightBits) - total);
+    
+    // 横方向の結果
+    std::vector<short> middle((size_t)stride*height);
+    
+    // 横方向 (Reference と同じ)
+    Plane<unsigned char> src = MakePlane(image);
+    Processing = [&](int startRow, int numRows) {
+        GaussianHorizontal(src, mask, startRow, numRows, [&](int iY, int p, unsigned char value) {
+            middle[(size_t)iY*stride + p] = value;
+        });
+    };
+    RunRows(height, numThreads);
+    
+    // 縦方向 (画像外の行はタップごと除く)
+    Processing = [&](int startRow, int numRows) {
+        std::vector<const short*> rows(filterSize);
+        for(int iY=startRow; iY<startRow+numRows; iY++) {
+            int first = std::max(0, halfSize - iY);
+            int last  = std::min(filterSize, height + halfSize - iY);
+            for(int j=first; j<last; j++) {
+                rows[j] = &middle[(size_t)(iY + j - halfSize)*stride];
+            }
+            kernels.convolveVerticalQ14(&rows[first], &weights[first], last-first,
+                                        (unsigned char*)&image.data[iY*width], stride);
+        }
+    };
+    RunRows(height, numThreads);
+}
+    
+//------------------------------------------------------------------------------
+// Gaussian フィルタ (再帰型)
+//
+// MEMO:
+// Young-van Vliet の3次の再帰フィルタを前向き・後ろ向きにかける
+// 縦方向はブロック単位で転置してから行として処理し、もう一度転置して戻す
+//------------------------------------------------------------------------------
+namespace {
+
+// 再帰フィルタの係数
+struct RecursiveGaussian {
+    float B, b1, b2, b3;
+    float M[3][3];
+    
+    RecursiveGaussian(double deviation) {
+        double q = (deviation >= 2.5) ? 0.98711*deviation - 0.96330
+                                      : 3.97156 - 4.14554*sqrt(1.0 - 0.26891*std::max(deviation, 0.5));
+        double q2 = q*q, q3 = q2*q;
+        double c0 =  1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+        double c1 =  2.44413*q + 2.85619*q2 + 1.26661*q3;
+        double c2 = -(1.4281*q2 + 1.26661*q3);
+        double c3 =  0.422205*q3;
+        double a1 = c1/c0, a2 = c2/c0, a3 = c3/c0;
+        b1 = (float)a1;
+        b2 = (float)a2;
+        b3 = (float)a3;
+        B  = (float)(1.0 - (a1+a2+a3));
         
-        for(int i=start; i<start + length; i++) {
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+        // 後ろ向きの初期値を求める行列 (Triggs-Sdika)
+        // 右端の外側も端の値が続くとすると、後ろ向きの初期値 (右端の外側3つ) と
+        // 端の値との差は、前向きの出力の最後の3つと端の値との差の線形結合になる
+        // 係数は単位入力を十分遠くまで流して数値的に求める
+        int length = (int)(20*deviation) + 100;
+        std::vector<double> w(length);
+        for(int k=0; k<3; k++) {
+            double h[3] = {0, 0, 0};
+            h[k] = 1;
+            for(int i=0; i<length; i++) {
+                w[i] = a1*h[0] + a2*h[1] + a3*h[2];
+                h[2] = h[1]; h[1] = h[0]; h[0] = w[i];
+            }
+            double v[3] = {0, 0, 0};
+            for(int i=length-1; i>=0; i--) {
+                double y = (1.0-(a1+a2+a3))*w[i] + a1*v[0] + a2*v[1] + a3*v[2];
+                v[2] = v[1]; v[1] = v[0]; v[0] = y;
+                if(i < 3) M[i][k] = (float)y;
+            }
+        }
+    }
+    
+    // RGB を並べた count 画素分を処理する (端の外側は端の値が続くものとする)
+    void Filter(float* line, int count) const {
+        for(int c=0; c<3; c++) {
             
-            double R=0, G=0, B=0;
+            // 右端の入力値 (前向きで上書きされるので先に取っておく)
+            float edge = line[(count-1)*3+c];
             
-            for(int j=0; j<filterSize; j++) {
-                int jX = iX + (j-halfSize)*horizontal;
-                int jY = iY + (j-halfSize)*vertical;
-                
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
-                
-                R += copy.pixel[jX][jY].r * LUT[j];
-                G += copy.pixel[jX][jY].g * LUT[j];
-                B += copy.pixel[jX][jY].b * LUT[j];
+            // 前向き
+            float w1 = line[c], w2 = w1, w3 = w1;
+            for(int i=0; i<count; i++) {
+                float w = B*line[i*3+c] + b1*w1 + b2*w2 + b3*w3;
+                line[i*3+c] = w;
+                w3 = w2; w2 = w1; w1 = w;
             }
             
-            image.pixel[iX][iY] = RGB(R, G, B);
+            // 後ろ向き (端の外側の前向きの出力から初期値を求める)
+            float u1 = w1-edge, u2 = w2-edge, u3 = w3-edge;
+            float y1 = M[0][0]*u1 + M[0][1]*u2 + M[0][2]*u3 + edge;
+            float y2 = M[1][0]*u1 + M[1][1]*u2 + M[1][2]*u3 + edge;
+            float y3 = M[2][0]*u1 + M[2][1]*u2 + M[2][2]*u3 + edge;
+            for(int i=count-1; i>=0; i--) {
+                float y = B*line[i*3+c] + b1*y1 + b2*y2 + b3*y3;
+                line[i*3+c] = y;
+                y3 = y2; y2 = y1; y1 = y;
+            }
         }
-    };
-    
-    // コピー
-    std::copy(image.data, image.data+image.Size(), copy.data);
-        
-    // 横方向
-    horizontal = 1;
-    vertical   = 0;
+    }
+};
 
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+// width x height 画素 (RGB) の src のうち、ブロック行 [startBlock, startBlock+numBlocks)
+// を転置して dst (height x width 画素) に書き込む
+void TransposeBlocks(const float* src, float* dst, int width, int height, int startBlock, int numBlocks) {
+    
+    const int block = 32;
+    
+    for(int by=startBlock*block; by<std::min(height, (startBlock+numBlocks)*block); by+=block) {
+        for(int bx=0; bx<width; bx+=block) {
+            for(int y=by; y<std::min(height, by+block); y++) {
+                for(int x=bx; x<std::min(width, bx+block); x++) {
+                    const float* s = &src[((size_t)y*width + x)*3];
+                    float*       d = &dst[((size_t)x*height + y)*3];
+                    d[0] = s[0]; d[1] = s[1]; d[2] = s[2];
+                }
+            }
+        }
+    }
+}
+
+}
+
+void GaussianFilter::ProcessRecursive(Image& image, double sigma) {
     
+    const int block = 32;
     
-    // コピー
-    std::copy(image.data, image.data+image.Size(), copy.data);
-        
-    // 横方向
-    horizontal = 0;
-    vertical   = 1;
-        
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    int width  = image.Width();
+    int height = image.Height();
+    int numThreads = std::thread::hardware_concurrency();
     
-    delete[] LUT;
+    RecursiveGaussian gaussian(sqrt(sigma/2));
+    
+    std::vector<float> buffer((size_t)image.Size()*3);
+    std::vector<float> transposed((size_t)image.Size()*3);
+    
+    // 横方向 (行ごと)
+    Processing = [&](int startRow, int numRows) {
+        for(int iY=startRow; iY<startRow+numRows; iY++) {
+            const unsigned char* src = (const unsigned char*)&image.data[iY*width];
+            float* line = &buffer[(size_t)iY*width*3];
+            for(int p=0; p<width*3; p++) {
+                line[p] = src[p];
+            }
+            gaussian.Filter(line, width);
+        }
+    };
+    RunRows(height, numThreads);
+    
+    // 転置
+    Processing = [&](int startBlock, int numBlocks) {
+        TransposeBlocks(buffer.data(), transposed.data(), width, height, startBlock, numBlocks);
+    };
+    RunRows((height+block-1)/block, numThreads);
+    
+    // 縦方向 (転置した行ごと)
+    Processing = [&](int startRow, int numRows) {
+        for(int iX=startRow; iX<startRow+numRows; iX++) {
+            gaussian.Filter(&transposed[(size_t)iX*height*3], height);
+        }
+    };
+    RunRows(width, numThreads);
+    
+    // 転置して戻す
+    Processing = [&](int startBlock, int numBlocks) {
+        TransposeBlocks(transposed.data(), buffer.data(), height, width, startBlock, numBlocks);
+    };
+    RunRows((width+block-1)/block, numThreads);
+    
+    // 書き戻し
+    Processing = [&](int startRow, int numRows) {
+        for(int iY=startRow; iY<startRow+numRows; iY++) {
+            const float* line = &buffer[(size_t)iY*width*3];
+            unsigned char* dst = (unsigned char*)&image.data[iY*width];
+            for(int p=0; p<width*3; p++) {
+                dst[p] = (unsigned char)std::min(255.0f, std::max(0.0f, line[p] + 0.5f));
+            }
+        }
+    };
+    RunRows(height, numThreads);
 }
     
 //------------------------------------------------------------------------------
 // Bilateral フィルタ
 //------------------------------------------------------------------------------
-BilateralFilter::BilateralFilter(Image& image, int filterSize, double sigma, double sigma2) {
+BilateralFilter::BilateralFilter(Image& image, int filterSize, double sigma, double sigma2, Mode mode) {
+    
+    if(mode == Grid) {
+        BilateralGridFilter::Process(image, sigma, sigma2);
+        return;
+    }
     
     struct dRGB { double r=0, g=0, b=0; };
     
@@ -337,120 +865,286 @@ BilateralFilter::BilateralFilter(Image& image, int filterSize, double sigma, dou
         LUT[ i ] = exp(-(iX*iX+iY*iY)/sig);
     }
     
+    // 値の差に対する重み
+    RangeWeightTable range(sig2);
+    
     // コピー
     Image copy = image;
+    
+    int width = image.Width();
+    Neighborhood region(width, image.Height(), filterSize);
 
-    // 処理本体
-    Processing = [&](int start, int length){
+    // 処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows){
+        
+        // 画像内の窓 [x0, x1] x [y0, y1] で (iX, iY) を処理する (マスクと同じ順に足し込む)
+        auto process = [&](int iX, int iY, int x0, int y0, int x1, int y1) {
             
-        for(int i=start; i<start + length; i++) {
-
-            int iX = i % image.Width();
-            int iY = i / image.Width();
+            int i = iY*width + iX;
+            const RGB& center = copy.data[i];
                 
             dRGB sum; // ピクセルとの計算結果合計値
             dRGB div; // 正規化用のフィルタ値合計
                 
-            for(int j=0; j<filterSize*filterSize; j++) {
-
-                int jX = iX + j%filterSize - halfSize;
-                int jY = iY + j/filterSize - halfSize;
+            for(int jY=y0; jY<=y1; jY++) {
+                const double* mask = &LUT[(jY-iY+halfSize)*filterSize];
+                const RGB*    row  = &copy.data[jY*width];
                 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
+                for(int jX=x0; jX<=x1; jX++) {
+                    const RGB& pixel = row[jX];
+                    double spatial = mask[jX-iX+halfSize];
                     
-                dRGB lateral, filter;
+                    dRGB filter;
+                    filter.r = spatial * range(center.r - pixel.r);
+                    filter.g = spatial * range(center.g - pixel.g);
+                    filter.b = spatial * range(center.b - pixel.b);
                     
-                lateral.r = (copy.pixel[iX][iY].r - copy.pixel[jX][jY].r);
-                lateral.g = (copy.pixel[iX][iY].g - copy.pixel[jX][jY].g);
-                lateral.b = (copy.pixel[iX][iY].b - copy.pixel[jX][jY].b);
+                    sum.r += filter.r * pixel.r;
+                    sum.g += filter.g * pixel.g;
+                    sum.b += filter.b * pixel.b;
                     
-                lateral.r = exp( -lateral.r*lateral.r / sig2 );
-                lateral.g = exp( -lateral.g*lateral.g / sig2 );
-                lateral.b = exp( -lateral.b*lateral.b / sig2 );
-                        
-                filter.r = LUT[j] * lateral.r;
-                filter.g = LUT[j] * lateral.g;
-                filter.b = LUT[j] * lateral.b;
-                    
-                sum.r += filter.r * copy.pixel[jX][jY].r;
-                sum.g += filter.g * copy.pixel[jX][jY].g;
-                sum.b += filter.b * copy.pixel[jX][jY].b;
-                    
-                div.r += filter.r;
-                div.g += filter.g;
-                div.b += filter.b;
+                    div.r += filter.r;
+                    div.g += filter.g;
+                    div.b += filter.b;
+                }
             }
             
-            image.pixel[iX][iY].r = (unsigned char)std::max(0.0,std::min(255.0,sum.r/div.r));
-            image.pixel[iX][iY].g = (unsigned char)std::max(0.0,std::min(255.0,sum.g/div.g));
-            image.pixel[iX][iY].b = (unsigned char)std::max(0.0,std::min(255.0,sum.b/div.b));
-        }
+            image.data[i].r = (unsigned char)std::max(0.0,std::min(255.0,sum.r/div.r));
+            image.data[i].g = (unsigned char)std::max(0.0,std::min(255.0,sum.g/div.g));
+            image.data[i].b = (unsigned char)std::max(0.0,std::min(255.0,sum.b/div.b));
+        };
+        
+        region.ForEachWindow(startRow, numRows, process);
     };
     
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
     
     delete[] LUT;
 }
     
 //------------------------------------------------------------------------------
-// Sobel フィルタ
+// Bilateral フィルタ (バイラテラルグリッドによる近似)
 //------------------------------------------------------------------------------
-SobelFilter::SobelFilter(Image& image) {
+BilateralGridFilter::BilateralGridFilter(Image& image, double sigma, double sigma2,
+                                         double samplingSpatial, double samplingRange) {
     
-    // コピー
-    Image copy = image;
+    // グリッドのセル (画素値の合計と重みの合計)
+    struct Cell { float value = 0, weight = 0; };
     
-    int horizontal_kernel[] = {
-        -1, 0, 1,
-        -2, 0, 2,
-        -1, 0, 1
-    };
+    // グリッドのセル数の上限 (grid と blurred で 2 * 8 バイトずつ, 約 256MB)
+    const double maxGridCells = 1 << 24;
     
-    int vertical_kernel[] = {
-        -1, -2, -1,
-        0,  0,  0,
-        1,  2,  1
-    };
+    // 0 以下や NaN ではセルの間隔やマスクが求まらない
+    if(!(sigma > 0) || !(sigma2 > 0) || !(samplingSpatial > 0) || !(samplingRange > 0)) {
+        std::cerr<<"Error: Bilateral Grid Parameters Must Be Positive"<<std::endl;
+        throw "Bilateral Grid Error";
+    }
     
-    int dx[] = {-1,0,1,-1,0,1,-1,0,1};
-    int dy[] = {-1,-1,-1,0,0,0,1,1,1};
-
+    int width  = image.Width();
+    int height = image.Height();
+    int numThreads = std::thread::hardware_concurrency();
     
-    // 画像処理本体
-    Processing = [&](int start, int length) {
+    std::vector<float> kernel[3];
+    int pad[3], size[3];
+    double scale[3];
+    int extent[3] = { width-1, height-1, 255 };
+    
+    // セルの間隔を決める (セル数が上限を超える場合は、空間方向と値方向の間隔を
+    // 同じ比率で広げて作り直す)
+    for(;;) {
         
-        for(int i=start; i<start+length; i++) {
+        // グリッド上での Gaussian の標準偏差 (セル単位) とマスクの半径
+        double cellSigma[3] = { sigma/samplingSpatial, sigma/samplingSpatial, sigma2/samplingRange };
+        scale[0] = scale[1] = 1.0/samplingSpatial;
+        scale[2] = 1.0/samplingRange;
+        
+        // グリッドの大きさ (ぼかしがはみ出さないよう周囲にマスクの半径分の余白をとる)
+        // (int に収まるか分からないので double で求める)
+        double radius[3], length[3];
+        for(int axis=0; axis<3; axis++) {
+            radius[axis] = std::max(1.0, ceil(3*cellSigma[axis]));
+            length[axis] = floor(extent[axis]*scale[axis] + 0.5) + 1 + (radius[axis] + 1)*2;
+        }
+        
+        double cells = length[0] * length[1] * length[2];
+        if(cells <= maxGridCells) {
+            for(int axis=0; axis<3; axis++) {
+                int r = (int)radius[axis];
+                kernel[axis].resize(r*2+1);
+                for(int k=-r; k<=r; k++) {
+                    kernel[axis][k+r] = (float)exp(-k*k / (2*cellSigma[axis]*cellSigma[axis]));
+                }
+                pad[axis]  = r + 1;
+                size[axis] = (int)length[axis];
+            }
+            break;
+        }
+        
+        double factor = std::max(1.01, cbrt(cells / maxGridCells));
+        samplingSpatial *= factor;
+        samplingRange   *= factor;
+    }
+    int step[3] = { 1, size[0], size[0]*size[1] };
+    
+    std::vector<Cell> grid((size_t)size[0]*size[1]*size[2]);
+    std::vector<Cell> blurred(grid.size());
+    
+    for(int c=0; c<3; c++) {
+        
+        // 足し込み (最も近いセルへ)
+        std::fill(grid.begin(), grid.end(), Cell());
+        for(int iY=0; iY<height; iY++) {
+            const unsigned char* src = (const unsigned char*)&image.data[iY*width];
+            int y = (int)(iY*scale[1] + 0.5) + pad[1];
+            for(int iX=0; iX<width; iX++) {
+                int x = (int)(iX*scale[0] + 0.5) + pad[0];
+                int z = (int)(src[iX*3+c]*scale[2] + 0.5) + pad[2];
+                Cell& cell = grid[(size_t)z*step[2] + y*step[1] + x];
+                cell.value  += src[iX*3+c];
+                cell.weight += 1;
+            }
+        }
+        
+        // 軸ごとにぼかす (grid -> blurred -> grid -> blurred)
+        for(int axis=0; axis<3; axis++) {
+            const std::vector<Cell>& src = (axis == 1) ? blurred : grid;
+            std::vector<Cell>&       dst = (axis == 1) ? grid : blurred;
+            
+            // 処理する軸以外の2軸で並ぶ線の数
+            int other0 = (axis == 0) ? 1 : 0;
+            int other1 = (axis == 2) ? 1 : 2;
+            int radius = (int)kernel[axis].size()/2;
             
-            int iX = i%image.Width();
-            int iY = i/image.Width();
+            Processing = [&](int startLine, int numLines) {
+                for(int line=startLine; line<startLine+numLines; line++) {
+                    size_t base = (size_t)(line % size[other0]) * step[other0] +
+                                  (size_t)(line / size[other0]) * step[other1];
+                    for(int i=0; i<size[axis]; i++) {
+                        Cell sum;
+                        for(int k=std::max(-radius,-i); k<=std::min(radius,size[axis]-1-i); k++) {
+                            const Cell& cell = src[base + (size_t)(i+k)*step[axis]];
+                            sum.value  += kernel[axis][k+radius] * cell.value;
+                            sum.weight += kernel[axis][k+radius] * cell.weight;
+                        }
+                        dst[base + (size_t)i*step[axis]] = sum;
+                    }
+                }
+            };
+            RunRows(size[other0]*size[other1], numThreads);
+        }
+        
+        // 3線形補間で読み出す
+        Processing = [&](int startRow, int numRows) {
+            for(int iY=startRow; iY<startRow+numRows; iY++) {
+                unsigned char* dst = (unsigned char*)&image.data[iY*width];
+                
+                double fy = iY*scale[1] + pad[1];
+                int    y  = (int)fy;
+                float  ty = (float)(fy - y);
+                
+                for(int iX=0; iX<width; iX++) {
+                    double fx = iX*scale[0] + pad[0];
+                    double fz = dst[iX*3+c]*scale[2] + pad[2];
+                    int   x  = (int)fx, z = (int)fz;
+                    float tx = (float)(fx - x), tz = (float)(fz - z);
+                    
+                    float value = 0, weight = 0;
+                    for(int k=0; k<8; k++) {
+                        int dx = k&1, dy = (k>>1)&1, dz = k>>2;
+                        float w = (dx ? tx : 1-tx) * (dy ? ty : 1-ty) * (dz ? tz : 1-tz);
+                        const Cell& cell = blurred[(size_t)(z+dz)*step[2] + (y+dy)*step[1] + x+dx];
+                        value  += w * cell.value;
+                        weight += w * cell.weight;
+                    }
+                    dst[iX*3+c] = (unsigned char)std::min(255.0f, std::max(0.0f, value/weight + 0.5f));
+                }
+            }
+        };
+        RunRows(height, numThreads);
+    }
+}
+    
+//------------------------------------------------------------------------------
+// Sobel, Laplacian フィルタのカーネル
+//
+// MEMO:
+// 畳み込みエンジンで 16bit 整数のまま積和をとる (画像外のタップは 0 とする)
+// カーネルは miConvolution.h の SobelXKernel, SobelYKernel, LaplacianKernel で、
+// 重みを型に持つので 0 のタップは展開時に省かれる
+// 内側は積和と変換をまとめた命令セットごとの処理 (miKernels.h の sobelInterior,
+// laplacianInterior) をエンジンから呼び、端だけエンジンの積和を変換する
+//------------------------------------------------------------------------------
+namespace {
 
-            int rh=0, gh=0, bh=0;
-            int rv=0, gv=0, bv=0;
 
-            for(int j=0; j<9; j++) {
-                int jX = iX + dx[j];
-                int jY = iY + dy[j];
+// dst[p] = min(255, sqrt(gx[p]*gx[p] + gy[p]*gy[p])) (p = 0..count-1)
+void SobelMagnitude(const short* gx, const short* gy, unsigned char* dst, int count) {
+    int p = 0;
+#ifdef __SSE2__
+    for(; p+8<=count; p+=8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(gx+p));
+        __m128i y = _mm_loadu_si128((const __m128i*)(gy+p));
+        
+        // gx*gx + gy*gy を 32bit で求めて平方根をとる
+        __m128i lo = _mm_unpacklo_epi16(x, y);
+        __m128i hi = _mm_unpackhi_epi16(x, y);
+        lo = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(lo, lo))));
+        hi = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hi, hi))));
+        __m128i v = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i*)(dst+p), _mm_packus_epi16(v, v));
+    }
+#endif
+    for(; p<count; p++) {
+        dst[p] = (unsigned char)std::min(255, (int)sqrtf((float)(gx[p]*gx[p] + gy[p]*gy[p])));
+    }
+}
 
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
-                
-                rh += copy.pixel[jX][jY].r * horizontal_kernel[j];
-                gh += copy.pixel[jX][jY].g * horizontal_kernel[j];
-                bh += copy.pixel[jX][jY].b * horizontal_kernel[j];
 
-                rv += copy.pixel[jX][jY].r * vertical_kernel[j];
-                gv += copy.pixel[jX][jY].g * vertical_kernel[j];
-                bv += copy.pixel[jX][jY].b * vertical_kernel[j];
-            }
-            
-            image.pixel[iX][iY].r = (unsigned char)sqrt((double)(rv*rv + rh*rh));
-            image.pixel[iX][iY].g = (unsigned char)sqrt((double)(gv*gv + gh*gh));
-            image.pixel[iX][iY].b = (unsigned char)sqrt((double)(bv*bv + bh*bh));
-        }
+}
+
+//------------------------------------------------------------------------------
+// Sobel フィルタ
+//------------------------------------------------------------------------------
+SobelFilter::SobelFilter(Image& image) {
+    Initialize(image, nullptr, nullptr);
+}
+
+SobelFilter::SobelFilter(Image& image, std::vector<short>& gradientX, std::vector<short>& gradientY) {
+    gradientX.resize((size_t)image.Size()*3);
+    gradientY.resize((size_t)image.Size()*3);
+    Initialize(image, gradientX.data(), gradientY.data());
+}
+
+void SobelFilter::Initialize(Image& image, short* gradientX, short* gradientY) {
+    
+    int stride = image.Width()*3;
+    
+    // コピー
+    Image copy = image;
+    Plane<unsigned char> src = MakePlane(copy);
+    SobelXKernel sobelX;
+    SobelYKernel sobelY;
+    const Kernels& kernels = CurrentKernels();
+    
+    // 画像処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows) {
+        ConvolveSegments<BorderPolicy::Zero, short>(src, std::tie(sobelX, sobelY), startRow, numRows,
+            [&](int iY, int begin, int end, const short* const* sums, const short* const*) {
+                size_t offset = (size_t)iY*stride;
+                SobelMagnitude(sums[0]+begin, sums[1]+begin, (unsigned char*)image.data + offset + begin, end-begin);
+                if(gradientX) std::copy(sums[0]+begin, sums[0]+end, gradientX+offset+begin);
+                if(gradientY) std::copy(sums[1]+begin, sums[1]+end, gradientY+offset+begin);
+            },
+            [&](int iY, const unsigned char* const* rows, int begin, int end) {
+                size_t offset = (size_t)iY*stride;
+                kernels.sobelInterior(rows[0], rows[1], rows[2], begin, end, (unsigned char*)image.data + offset,
+                                      gradientX ? gradientX+offset : nullptr, gradientY ? gradientY+offset : nullptr);
+            });
     };
     
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
 }
 
 
@@ -459,48 +1153,27 @@ SobelFilter::SobelFilter(Image& image) {
 //------------------------------------------------------------------------------
 LaplacianFilter::LaplacianFilter(Image& image) {
 
+    int stride = image.Width()*3;
+    
     // コピー
     Image copy = image;
+    Plane<unsigned char> src = MakePlane(copy);
+    const Kernels& kernels = CurrentKernels();
 
-    int kernel[] = {
-        1,  1, 1,
-        1, -8, 1,
-        1,  1, 1
-    };
-
-    int dx[] = {-1,0,1,-1,0,1,-1,0,1};
-    int dy[] = {-1,-1,-1,0,0,0,1,1,1};
-
-
-    // 画像処理本体
-    Processing = [&](int start, int length) {
-
-        for(int i=start; i<start+length; i++) {
-
-            int iX = i%image.Width();
-            int iY = i/image.Width();
-
-            int r=0, g=0, b=0;
-
-            for(int j=0; j<9; j++) {
-                int jX = iX + dx[j];
-                int jY = iY + dy[j];
-
-                if(jX<0 || jX>=image.Width() || jY<0 || jY>=image.Height()) continue;
-                
-                r += copy.pixel[jX][jY].r * kernel[j];
-                g += copy.pixel[jX][jY].g * kernel[j];
-                b += copy.pixel[jX][jY].b * kernel[j];
-            }
-
-            image.pixel[iX][iY].r = (unsigned char)std::min(std::max(r,0),255);
-            image.pixel[iX][iY].g = (unsigned char)std::min(std::max(g,0),255);
-            image.pixel[iX][iY].b = (unsigned char)std::min(std::max(b,0),255);
-        }
+    // 画像処理本体 (開始行と行数が渡される)
+    Processing = [&](int startRow, int numRows) {
+        ConvolveSegments<BorderPolicy::Zero, short>(src, LaplacianKernel(), startRow, numRows,
+            [&](int iY, int begin, int end, const short* sums, const short*) {
+                std::transform(sums+begin, sums+end, (unsigned char*)image.data + (size_t)iY*stride + begin,
+                               [](short sum) { return (unsigned char)std::min(std::max((int)sum, 0), 255); });
+            },
+            [&](int iY, const unsigned char* const* rows, int begin, int end) {
+                kernels.laplacianInterior(rows[0], rows[1], rows[2], begin, end, (unsigned char*)image.data + (size_t)iY*stride);
+            });
     };
 
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(image, std::thread::hardware_concurrency());
 }
 
     
@@ -509,17 +1182,15 @@ LaplacianFilter::LaplacianFilter(Image& image) {
 //------------------------------------------------------------------------------
 HistgramEqualization::HistgramEqualization(Image& image) {
     
-    int histgram[256] = {0};
     int LUT[256] =  {0};
     
-    // ヒストグラム作成
-    for(int i=0; i<image.Size(); i++){
-        histgram[ image.data[i].r ]++;
-    }
+    // ヒストグラム作成 (R チャンネル)
+    ImageStatistics statistics(image, ImageStatistics::RChannel);
+    const long long* histgram = statistics.Histgram(ImageStatistics::R);
 
     // 均一化処理用のテーブルを生成
     double sum = 0;
-    int min = histgram[0] / image.Size();
+    int min = (int)(histgram[0] / image.Size());
     for(int i=0; i<256; i++) {
         sum += histgram[i];
         LUT[i] = (int)(255.0 * (sum/image.Size() - min) / (1.0 - min));
@@ -540,59 +1211,182 @@ HistgramEqualization::HistgramEqualization(Image& image) {
 
     
 //------------------------------------------------------------------------------
-// ヒストグラム伸張
+// 適応的ヒストグラム均一化 (CLAHE)
 //------------------------------------------------------------------------------
-HistgramExtention::HistgramExtention(Image& image) {
-    
-    Image mono = image;
-    
-    mi::Monochrome::Process(mono);
+namespace {
 
-    unsigned char LUT[256] = {0};
-    unsigned char min = mono.data[0].r;
-    unsigned char max = mono.data[0].r;
-    
-    // 最大値・最小値
-    for(int i=1; i<image.Size(); i++) {
-        min = std::min(min, mono.data[i].r);
-        max = std::max(max, mono.data[i].r);
+// length 画素を tiles 個に分けたタイル index の範囲 [TileBound(index), TileBound(index+1))
+inline int TileBound(int index, int length, int tiles) {
+    return (int)((long long)index * length / tiles);
+}
+
+// 各画素について補間に使う2つのタイル (first, second) と second の重み (0..256) を求める
+// (画素の中心が両端のタイルの中心より外側なら、そのタイルだけを使う)
+void TileInterpolation(int length, int tiles, int* first, int* second, int* weight) {
+    int tile = 0;
+    for(int p=0; p<length; p++) {
+        double position = p + 0.5;
+        while(tile+1 < tiles &&
+              (TileBound(tile+1, length, tiles) + TileBound(tile+2, length, tiles)) / 2.0 <= position) {
+            tile++;
+        }
+        double center = (TileBound(tile, length, tiles) + TileBound(tile+1, length, tiles)) / 2.0;
+        if(position <= center || tile+1 == tiles) {
+            first[p] = second[p] = tile;
+            weight[p] = 0;
+            continue;
+        }
+        double next = (TileBound(tile+1, length, tiles) + TileBound(tile+2, length, tiles)) / 2.0;
+        first[p]  = tile;
+        second[p] = tile+1;
+        weight[p] = (int)floor((position - center) / (next - center) * 256 + 0.5);
     }
+}
 
-    // 伸張処理用のテーブルを生成
-    for(int i=0; i<256; i++) {
-        LUT[i] = (unsigned char)(255.0 / (max-min) * (i-min));
+}
+
+AdaptiveHistgramEqualization::AdaptiveHistgramEqualization(Image& image, int tileSize, double clipLimit) {
+    
+    int width  = image.Width();
+    int height = image.Height();
+    int numThreads = std::thread::hardware_concurrency();
+    if(image.Size() == 0) return;
+    
+    // タイルの数 (tileSize に最も近い大きさで画像を等分する)
+    tileSize = std::max(1, tileSize);
+    int tilesX = std::max(1, (width  + tileSize/2) / tileSize);
+    int tilesY = std::max(1, (height + tileSize/2) / tileSize);
+    
+    // 輝度
+    std::vector<unsigned char> luma(image.Size());
+    ToLuma(image, luma.data());
+    
+    // タイルごとの参照テーブル (タイルの行単位で並列に作る)
+    std::vector<unsigned char> LUTs((size_t)tilesX*tilesY*256);
+    Processing = [&](int startRow, int numRows) {
+        for(int tY=startRow; tY<startRow+numRows; tY++) {
+            int y0 = TileBound(tY, height, tilesY);
+            int y1 = TileBound(tY+1, height, tilesY);
+            for(int tX=0; tX<tilesX; tX++) {
+                int x0 = TileBound(tX, width, tilesX);
+                int x1 = TileBound(tX+1, width, tilesX);
+                int pixels = (x1-x0)*(y1-y0);
+                
+                // ヒストグラム作成
+                int histgram[256] = {0};
+                for(int iY=y0; iY<y1; iY++) {
+                    const unsigned char* src = &luma[iY*width];
+                    for(int iX=x0; iX<x1; iX++) histgram[src[iX]]++;
+                }
+                
+                // 頭打ちにして、超えた分を全体に均等に配る (割り切れない分は間隔をあけて1ずつ)
+                if(clipLimit > 0) {
+                    int limit = std::max(1, (int)(clipLimit * pixels / 256));
+                    int excess = 0;
+                    for(int i=0; i<256; i++) {
+                        if(histgram[i] > limit) {
+                            excess += histgram[i] - limit;
+                            histgram[i] = limit;
+                        }
+                    }
+                    int share = excess / 256;
+                    int rest  = excess % 256;
+                    for(int i=0; i<256; i++) histgram[i] += share;
+                    if(rest > 0) {
+                        int step = 256 / rest;
+                        for(int i=0; i<256 && rest>0; i+=step, rest--) histgram[i]++;
+                    }
+                }
+                
+                // 累積分布から均一化の表を作る
+                unsigned char* LUT = &LUTs[((size_t)tY*tilesX + tX)*256];
+                long long sum = 0;
+                for(int i=0; i<256; i++) {
+                    sum += histgram[i];
+                    LUT[i] = (unsigned char)((sum*255 + pixels/2) / pixels);
+                }
+            }
+        }
+    };
+    RunRows(tilesY, numThreads);
+    
+    // 画素ごとの補間に使うタイルと重み (横方向はタイルの表の先頭位置にしておく)
+    std::vector<int> firstX(width), secondX(width), weightX(width);
+    std::vector<int> firstY(height), secondY(height), weightY(height);
+    TileInterpolation(width,  tilesX, firstX.data(), secondX.data(), weightX.data());
+    TileInterpolation(height, tilesY, firstY.data(), secondY.data(), weightY.data());
+    for(int iX=0; iX<width; iX++) {
+        firstX[iX]  *= 256;
+        secondX[iX] *= 256;
     }
     
-    // ヒストグラムの伸張処理
-    Processing = [&](int start, int length) {
-        for(int i=start; i<start+length; i++) {
-            image.data[i].r = LUT[image.data[i].r];
-            image.data[i].g = LUT[image.data[i].g];
-            image.data[i].b = LUT[image.data[i].b];
+    // 周囲4タイルの表の値を双線形補間する (1行分の輝度を求めてから R = G = B に広げる)
+    Processing = [&](int startRow, int numRows) {
+        std::vector<unsigned char> row(width);
+        for(int iY=startRow; iY<startRow+numRows; iY++) {
+            const unsigned char* top    = &LUTs[(size_t)firstY[iY]*tilesX*256];
+            const unsigned char* bottom = &LUTs[(size_t)secondY[iY]*tilesX*256];
+            const unsigned char* src = &luma[iY*width];
+            int wY = weightY[iY];
+            for(int iX=0; iX<width; iX++) {
+                int v  = src[iX];
+                int l  = firstX[iX] + v;
+                int r  = secondX[iX] + v;
+                int wX = weightX[iX];
+                int upper = top[l]*(256-wX)    + top[r]*wX;
+                int lower = bottom[l]*(256-wX) + bottom[r]*wX;
+                row[iX] = (unsigned char)((upper*(256-wY) + lower*wY + 32768) >> 16);
+            }
+            FromLuma(row.data(), &image.data[iY*width], width);
         }
     };
-    
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(height, numThreads);
+}
+
+
+//------------------------------------------------------------------------------
+// ヒストグラム伸張
+//------------------------------------------------------------------------------
+HistgramExtention::HistgramExtention(Image& image) {
+    PointPipeline().HistgramExtention().Process(image);
 }
 
 
 //------------------------------------------------------------------------------
 // アルファブレンド
 //------------------------------------------------------------------------------
-AlphaBlend::AlphaBlend(Image& image, const Image& blend, double alpha) {
-    
-    double beta = 1.0-alpha;
-    
-    // アルファブレンド処理
-    Processing = [&](int start, int length) {
-        for(int i=start; i<start+length; i++) {
-            image.data[i] = image.data[i] * beta + blend.data[i] * alpha;
+AlphaBlend::AlphaBlend(Image& image, const Image& blend, double alpha, int offsetX, int offsetY) {
+    Composite(image, blend, nullptr, alpha, offsetX, offsetY);
+}
+
+AlphaBlend::AlphaBlend(Image& image, const Image& blend, const unsigned char* alpha, int offsetX, int offsetY, double opacity) {
+    Composite(image, blend, alpha, opacity, offsetX, offsetY);
+}
+
+void AlphaBlend::Composite(Image& image, const Image& blend, const unsigned char* alpha, double opacity, int offsetX, int offsetY) {
+    
+    // 重なる範囲 [x0,x1) x [y0,y1)
+    int x0 = std::max(0, offsetX);
+    int y0 = std::max(0, offsetY);
+    int x1 = std::min(image.Width(),  offsetX + blend.Width());
+    int y1 = std::min(image.Height(), offsetY + blend.Height());
+    if(x0 >= x1 || y0 >= y1) return;
+    
+    // 不透明度 (0..255)
+    int a = (int)floor(std::min(1.0, std::max(0.0, opacity)) * 255 + 0.5);
+    const Kernels& kernels = CurrentKernels();
+    
+    // 画像処理本体 (重なる範囲の開始行からの行番号が渡される)
+    Processing = [&](int startRow, int numRows) {
+        for(int iY=y0+startRow; iY<y0+startRow+numRows; iY++) {
+            int index = (iY - offsetY) * blend.Width() + (x0 - offsetX);
+            kernels.blend((const unsigned char*)&blend.data[index], alpha ? &alpha[index] : nullptr, a,
+                          (unsigned char*)&image.data[iY*image.Width() + x0], x1-x0);
         }
     };
     
     // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    RunRows(y1-y0, std::thread::hardware_concurrency());
 }
     
 
@@ -600,25 +1394,7 @@ AlphaBlend::AlphaBlend(Image& image, const Image& blend, double alpha) {
 // ガンマ補正
 //------------------------------------------------------------------------------
 GammaCollection::GammaCollection(Image& image, double param) {
-    
-    unsigned char LUT[256];
-    
-    for(int i=0; i<256; i++) {
-        LUT[i] = (unsigned char)(255*pow(i/255.0,1.0/param));
-    }
-    
-    // ガンマ補正処理
-    Processing = [&](int start, int length) {
-        for(int i=start; i<start+length; i++) {
-            
-            image.data[i].r = LUT[image.data[i].r];
-            image.data[i].g = LUT[image.data[i].g];
-            image.data[i].b = LUT[image.data[i].b];
-        }
-    };
-
-    // Processingの処理をおこなう
-    Run(image, std::thread::hardware_concurrency());
+    PointPipeline().Gamma(param).Process(image);
 }
 
 }
\ No newline at end of file
@@ -8,9 +8,30 @@
 
 #include "miImage.h"
 #include <functional>
+#include <vector>
 
 namespace mi {
 
+//------------------------------------------------------------------------------
+// フィルタ内部の並列化を止めるスコープ
+//
+// MEMO:
+// タイル単位などで既に並列に処理しているスレッドでは、フィルタの中で更にスレッドを
+// 作らないよう、このオブジェクトがある間 Run, RunRows を呼び出したスレッドで処理する
+//------------------------------------------------------------------------------
+class SerialScope {
+public:
+    SerialScope();
+    ~SerialScope();
+    
+    // このスレッドがスコープの中か
+    static bool IsActive();
+    
+private:
+    bool previous;
+};
+
+
 //------------------------------------------------------------------------------
 // 画像処理インターフェイスクラス
 //
@@ -29,6 +50,29 @@ protected:
     
     // 画像処理を分割実行する
     void Run(Image& image, int numThreads);
+    
+    // 画像処理を行単位で分割実行する
+    // Processing の第一引数に開始行, 第二引数に行数が渡される
+    // (行をまたいで状態を持ち回す処理に使う)
+    void RunRows(Image& image, int numThreads);
+    void RunRows(int numRows, int numThreads);
+};
+
+
+//------------------------------------------------------------------------------
+// 値の差に対する重みの参照テーブル (Bilateral 系フィルタの値方向のカーネル)
+//
+// MEMO:
+// 8bit の値の差 -255..255 の 511 通りについて exp(-d*d/sig2) を持っておき、
+// タップごとの exp を表引きに置き換える
+//------------------------------------------------------------------------------
+class RangeWeightTable {
+public:
+    RangeWeightTable(double sig2);
+    double operator()(int diff) const { return table[diff+255]; }
+    
+private:
+    double table[511];
 };
 
     
@@ -68,15 +112,45 @@ public:
 };
 
 
+//------------------------------------------------------------------------------
+// 適応的2値化処理 (Sauvola)
+//
+// MEMO:
+// 注目画素を中心とする filterSize 四方の輝度の平均 m と標準偏差 s から
+// 閾値 m * (1 + k * (s/128 - 1)) を求める。平均と分散は積分画像から求めるので
+// filterSize によらず一定の計算量
+//------------------------------------------------------------------------------
+class AdaptiveBinarize : IImageProcessing {
+public:
+    AdaptiveBinarize(Image& image, int filterSize, double k);
+    static void Process(Image& image, int filterSize, double k) {
+        AdaptiveBinarize filter(image, filterSize, k);
+    }
+};
+
+
 //------------------------------------------------------------------------------
 // メディアンフィルタ
+//
+// MEMO:
+// filterSize が 3, 5 のときは専用のソーティングネットワークで処理する
+// それ以外で HistgramThreshold 以上のときは列ヒストグラムをスライドさせる
+// 方法 (Perreault-Hebert) で処理し、1画素あたりの計算量をサイズに依存させない
+// 結果はどの方法でも同じになる
 //------------------------------------------------------------------------------
 class MedianFilter : IImageProcessing {
 public:
+    static const int HistgramThreshold = 5;
+    
     MedianFilter(Image& image, int filterSize);
     static void Process(Image& image, int filterSize) {
     MedianFilter filter(image,filterSize);
     }
+    
+private:
+    void ProcessSort(Image& image, int filterSize);
+    void ProcessHistgram(Image& image, int filterSize);
+    template<int Size> void ProcessNetwork(Image& image);
 };
 
     
@@ -94,35 +168,102 @@ public:
     
 //------------------------------------------------------------------------------
 // Gaussian フィルタ
+//
+// MEMO:
+// マスクは exp(-j*j/sigma) なので、正規分布の標準偏差は sqrt(sigma/2) にあたる
+// Auto は FixedPoint を使う (Recursive は明示的に指定したときだけ使う)
+// Recursive は画像端の外側を端の画素で延長したものとして扱い、マスクの幅も使わないため、
+// 端付近は Reference, FixedPoint (画像外のマスクを捨てる) と結果が大きく異なる
 //------------------------------------------------------------------------------
 class GaussianFilter : IImageProcessing {
 public:
-    GaussianFilter(Image& image, int filterSize, double sigma);
-    static void Process(Image& image, int filterSize, double sigma) {
-        GaussianFilter filter(image, filterSize, sigma);
+    
+    // 処理方法
+    enum Mode {
+        Auto,       // 自動で選ぶ (FixedPoint)
+        Reference,  // マスクを double で畳み込む (各方向の結果は切り捨て)
+        FixedPoint, // 縦方向のマスクを16bit整数にして SIMD で畳み込む (Reference との差は ±1 以内)
+        Recursive,  // 再帰型 (Young-van Vliet), 1画素あたりの計算量がマスクの幅によらない (端は延長)
+    };
+    
+    GaussianFilter(Image& image, int filterSize, double sigma, Mode mode = Auto);
+    static void Process(Image& image, int filterSize, double sigma, Mode mode = Auto) {
+        GaussianFilter filter(image, filterSize, sigma, mode);
     }
+    
+private:
+    void ProcessReference(Image& image, int filterSize, double sigma);
+    void ProcessFixedPoint(Image& image, int filterSize, double sigma);
+    void ProcessRecursive(Image& image, double sigma);
 };
     
 //------------------------------------------------------------------------------
 // Bilateral フィルタ
+//
+// MEMO:
+// Grid では BilateralGridFilter で近似する (filterSize は使わない)
 //------------------------------------------------------------------------------
 class BilateralFilter : IImageProcessing {
 public:
-    BilateralFilter(Image& image, int filterSize, double sigma, double sigma2);
-    static void Process(Image& image, int filterSize, double sigma, double sigma2) {
-        BilateralFilter filter(image, filterSize, sigma, sigma2);
+    
+    // 処理方法
+    enum Mode {
+        Exact, // 近傍 filterSize 四方を全て計算する
+        Grid,  // バイラテラルグリッドで近似する
+    };
+    
+    BilateralFilter(Image& image, int filterSize, double sigma, double sigma2, Mode mode = Exact);
+    static void Process(Image& image, int filterSize, double sigma, double sigma2, Mode mode = Exact) {
+        BilateralFilter filter(image, filterSize, sigma, sigma2, mode);
+    }
+};
+
+//------------------------------------------------------------------------------
+// Bilateral フィルタ (バイラテラルグリッドによる近似)
+//
+// MEMO:
+// チャンネルごとに (x, y, 画素値) の3次元グリッドへ画素を足し込み、グリッドを
+// Gaussian でぼかしてから、各画素の位置を3線形補間して読み出す
+// グリッドの間隔は空間方向 samplingSpatial 画素, 値方向 samplingRange 階調で、
+// 小さいほど精度が上がり遅くなる (省略時は sigma, sigma2 と同じ)
+// グリッドのセル数が上限 (約 1600 万) を超える場合は両方の間隔を同じ比率で広げる
+// sigma, sigma2, 間隔が 0 以下なら例外を投げる
+// 計算量は空間方向の sigma にほぼよらない
+//------------------------------------------------------------------------------
+class BilateralGridFilter : IImageProcessing {
+public:
+    BilateralGridFilter(Image& image, double sigma, double sigma2,
+                        double samplingSpatial, double samplingRange);
+    static void Process(Image& image, double sigma, double sigma2,
+                        double samplingSpatial, double samplingRange) {
+        BilateralGridFilter filter(image, sigma, sigma2, samplingSpatial, samplingRange);
+    }
+    static void Process(Image& image, double sigma, double sigma2) {
+        BilateralGridFilter filter(image, sigma, sigma2, sigma, sigma2);
     }
 };
     
 //------------------------------------------------------------------------------
 // Sobel フィルタ
+//
+// MEMO:
+// 勾配の大きさが 255 を超える画素は 255 にする
+// gradientX, gradientY を渡すと、チャンネルごとの横・縦の勾配を画素の順に
+// RGB で並べて書き込む (画像外のタップは 0 とする)
 //------------------------------------------------------------------------------
 class SobelFilter : IImageProcessing {
 public:
     SobelFilter(Image& image);
+    SobelFilter(Image& image, std::vector<short>& gradientX, std::vector<short>& gradientY);
     static void Process(Image& image) {
         SobelFilter filter(image);
     }
+    static void Process(Image& image, std::vector<short>& gradientX, std::vector<short>& gradientY) {
+        SobelFilter filter(image, gradientX, gradientY);
+    }
+    
+private:
+    void Initialize(Image& image, short* gradientX, short* gradientY);
 };
 
 //------------------------------------------------------------------------------
@@ -147,6 +288,24 @@ public:
     }
 };
 
+//------------------------------------------------------------------------------
+// 適応的ヒストグラム均一化 (CLAHE)
+//
+// MEMO:
+// 輝度を tileSize 四方程度のタイルに分け、タイルごとのヒストグラムを
+// clipLimit * (タイルの画素数 / 256) で頭打ちにして (超えた分は全体に配り直す)
+// 均一化の参照テーブルを作る。各画素は周囲4タイルの表の値を、タイル中心からの
+// 距離で双線形補間する。clipLimit が 0 以下なら頭打ちにしない
+// 出力は HistgramEqualization と同じく R = G = B
+//------------------------------------------------------------------------------
+class AdaptiveHistgramEqualization : IImageProcessing {
+public:
+    AdaptiveHistgramEqualization(Image& image, int tileSize = 64, double clipLimit = 2.0);
+    static void Process(Image& image, int tileSize = 64, double clipLimit = 2.0) {
+        AdaptiveHistgramEqualization filter(image, tileSize, clipLimit);
+    }
+};
+
 //------------------------------------------------------------------------------
 // ヒストグラム伸張
 //------------------------------------------------------------------------------
@@ -160,13 +319,30 @@ public:
 
 //------------------------------------------------------------------------------
 // アルファブレンド
+//
+// MEMO:
+// blend の左上を image の (offsetX, offsetY) に置き、重なる範囲だけを
+// image = (a*blend + (255-a)*image + 127) / 255 で合成する (a は 0..255)
+// a は全体で同じ値 (alpha を 255 倍して丸めたもの) か、画素ごとのアルファ
+// (blend と同じ大きさの 8bit の面, 32bit Bitmap のアルファは Image::Load で取り出せる) に
+// opacity を掛けたもの。行単位で並列に、命令セットごとのカーネルで処理する
 //------------------------------------------------------------------------------
 class AlphaBlend : IImageProcessing {
 public:
-    AlphaBlend(Image& image, const Image& blend, double alpha);
-    static void Process(Image& image, const Image& blend, double alpha) {
-        AlphaBlend filter(image, blend, alpha);
+    // 全体で同じアルファ
+    AlphaBlend(Image& image, const Image& blend, double alpha, int offsetX = 0, int offsetY = 0);
+    static void Process(Image& image, const Image& blend, double alpha, int offsetX = 0, int offsetY = 0) {
+        AlphaBlend filter(image, blend, alpha, offsetX, offsetY);
+    }
+
+    // 画素ごとのアルファ
+    AlphaBlend(Image& image, const Image& blend, const unsigned char* alpha, int offsetX, int offsetY, double opacity = 1.0);
+    static void Process(Image& image, const Image& blend, const unsigned char* alpha, int offsetX, int offsetY, double opacity = 1.0) {
+        AlphaBlend filter(image, blend, alpha, offsetX, offsetY, opacity);
     }
+
+private:
+    void Composite(Image& image, const Image& blend, const unsigned char* alpha, double opacity, int offsetX, int offsetY);
 };
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,153 @@
+//==============================================================================
+//
+// 画像の統計量
+//
+//==============================================================================
+#include "miImageStatistics.h"
+
+#include "miImageProcessing.h"
+#include "miLuma.h"
+
+#include <algorithm>
+#include <mutex>
+#include <thread>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// 行を分割して並列にヒストグラムを数える
+//
+// MEMO:
+// スレッドごとのヒストグラムに数え、最後にまとめて histgram に足す
+// (1スレッドが数える画素数は int に収まる)
+//------------------------------------------------------------------------------
+class HistgramPass : IImageProcessing {
+public:
+    HistgramPass(const Image& image, int target, const unsigned char (*table)[256],
+                 long long (*histgram)[256]) {
+
+        const bool luma = (target & ImageStatistics::LumaChannel) != 0;
+        const BlockLuma blockLuma(table);
+        const int width = image.Width();
+        std::mutex mutex;
+
+        Processing = [&](int startRow, int numRows) {
+            int local[ImageStatistics::NumChannels][256] = {{0}};
+            int start = startRow*width;
+            int end   = (startRow+numRows)*width;
+
+            // 3チャンネルとも数える場合は1回の走査で、それ以外はチャンネルごとに数える
+            // (参照テーブルがあれば適用した値)
+            if((target & ImageStatistics::ColorChannels) == ImageStatistics::ColorChannels) {
+                int* R = local[ImageStatistics::R];
+                int* G = local[ImageStatistics::G];
+                int* B = local[ImageStatistics::B];
+                if(table == nullptr) {
+                    for(int i=start; i<end; i++) {
+                        R[image.data[i].r]++;
+                        G[image.data[i].g]++;
+                        B[image.data[i].b]++;
+                    }
+                }
+                else {
+                    for(int i=start; i<end; i++) {
+                        R[table[0][image.data[i].r]]++;
+                        G[table[1][image.data[i].g]]++;
+                        B[table[2][image.data[i].b]]++;
+                    }
+                }
+            }
+            else {
+                for(int c=ImageStatistics::R; c<=ImageStatistics::B; c++) {
+                    if((target & (1 << c)) == 0) continue;
+                    int* H = local[c];
+                    const unsigned char* src = (const unsigned char*)image.data + c;
+                    if(table == nullptr) {
+                        for(int i=start; i<end; i++) H[src[i*3]]++;
+                    }
+                    else {
+                        for(int i=start; i<end; i++) H[table[c][src[i*3]]]++;
+                    }
+                }
+            }
+
+            if(luma) {
+                int* Y = local[ImageStatistics::Y];
+                unsigned char block[BlockLuma::BlockSize];
+                for(int i=start; i<end; i+=BlockLuma::BlockSize) {
+                    int count = std::min(BlockLuma::BlockSize, end-i);
+                    blockLuma(&image.data[i], count, block);
+                    for(int k=0; k<count; k++) Y[block[k]]++;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            for(int c=0; c<ImageStatistics::NumChannels; c++) {
+                for(int i=0; i<256; i++) histgram[c][i] += local[c][i];
+            }
+        };
+
+        RunRows(image.Height(), std::thread::hardware_concurrency());
+    }
+};
+
+}
+
+//------------------------------------------------------------------------------
+// コンストラクタ
+//------------------------------------------------------------------------------
+ImageStatistics::ImageStatistics(const Image& image, int target, const unsigned char (*table)[256])
+    : count(image.Size()) {
+
+    std::fill(&histgram[0][0], &histgram[0][0] + NumChannels*256, 0LL);
+
+    if(image.Size() > 0) {
+        HistgramPass pass(image, target, table, histgram);
+    }
+
+    // ヒストグラムから最小値・最大値・合計・2乗和を求める
+    for(int c=0; c<NumChannels; c++) {
+        min[c] = max[c] = 0;
+        sum[c] = squaredSum[c] = 0;
+
+        bool found = false;
+        for(int i=0; i<256; i++) {
+            if(histgram[c][i] == 0) continue;
+            if(!found) min[c] = i;
+            max[c] = i;
+            found = true;
+            sum[c]        += histgram[c][i] * i;
+            squaredSum[c] += histgram[c][i] * i * i;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// 平均, 分散
+//------------------------------------------------------------------------------
+double ImageStatistics::Mean(Channel channel) const {
+    return (count > 0) ? (double)sum[channel] / count : 0.0;
+}
+
+double ImageStatistics::Variance(Channel channel) const {
+    if(count == 0) return 0.0;
+    double mean = Mean(channel);
+    return std::max(0.0, (double)squaredSum[channel] / count - mean*mean);
+}
+
+//------------------------------------------------------------------------------
+// 小さい方から ratio の割合の画素を含む最小の値
+//------------------------------------------------------------------------------
+int ImageStatistics::Percentile(Channel channel, double ratio) const {
+    double threshold = ratio * count;
+    long long accumulated = 0;
+    for(int i=0; i<256; i++) {
+        accumulated += histgram[channel][i];
+        if(accumulated > 0 && accumulated >= threshold) return i;
+    }
+    return max[channel];
+}
+
+}
@@ -0,0 +1,87 @@
+//==============================================================================
+//
+// 画像の統計量
+//
+//==============================================================================
+#ifndef _MI_IMAGE_STATISTICS_H_
+#define _MI_IMAGE_STATISTICS_H_
+
+#include "miImage.h"
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 画像の統計量 (ヒストグラム, 最小値, 最大値, 合計, 2乗和)
+//
+// MEMO:
+// 画像を行で分割して並列に1回だけ走査し、スレッドごとのヒストグラムに数えてから
+// 最後に足し合わせる。最小値・最大値・合計・2乗和はヒストグラムの 256 段階から求める
+// 輝度は ToLuma と同じ固定小数点の値 (輝度を求めるぶん走査が重くなるので、
+// 必要なときだけ target に LumaChannel を指定する)
+// table を渡すと、チャンネルごとの参照テーブルを適用した画素について集計する
+//------------------------------------------------------------------------------
+class ImageStatistics {
+public:
+
+    // チャンネル
+    enum Channel {
+        R,
+        G,
+        B,
+        Y, // 輝度
+        NumChannels
+    };
+
+    // 集計するチャンネル
+    enum Target {
+        RChannel      = 1 << R,
+        GChannel      = 1 << G,
+        BChannel      = 1 << B,
+        LumaChannel   = 1 << Y,
+        ColorChannels = RChannel | GChannel | BChannel,
+        AllChannels   = ColorChannels | LumaChannel,
+    };
+
+    //--------------------------------------------------------------------------
+    // コンストラクタ
+    //--------------------------------------------------------------------------
+    ImageStatistics(const Image& image, int target = AllChannels, const unsigned char (*table)[256] = nullptr);
+
+
+    //--------------------------------------------------------------------------
+    // Getter (集計していないチャンネルはすべて 0)
+    //--------------------------------------------------------------------------
+
+    // 画素数
+    long long Count() const { return count; }
+
+    // ヒストグラム (256 要素)
+    const long long* Histgram(Channel channel) const { return histgram[channel]; }
+
+    // 最小値・最大値 (画素がない場合は 0)
+    int Min(Channel channel) const { return min[channel]; }
+    int Max(Channel channel) const { return max[channel]; }
+
+    // 合計, 2乗和
+    long long Sum(Channel channel) const { return sum[channel]; }
+    long long SquaredSum(Channel channel) const { return squaredSum[channel]; }
+
+    // 平均, 分散
+    double Mean(Channel channel) const;
+    double Variance(Channel channel) const;
+
+    // 小さい方から ratio (0..1) の割合の画素を含む最小の値
+    int Percentile(Channel channel, double ratio) const;
+
+private:
+    long long count;
+    long long histgram[NumChannels][256];
+    int min[NumChannels];
+    int max[NumChannels];
+    long long sum[NumChannels];
+    long long squaredSum[NumChannels];
+};
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+//==============================================================================
+//
+// 積分画像 (Summed-area table)
+//
+//==============================================================================
+#include "miIntegralImage.h"
+#include "miImageProcessing.h"
+
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// 表の行または列の範囲 [0, count) を分割実行する
+//------------------------------------------------------------------------------
+class TablePass : IImageProcessing {
+public:
+    TablePass(int count, const std::function<void(int, int)>& process) {
+        Processing = process;
+        RunRows(count, std::thread::hardware_concurrency());
+    }
+};
+
+}
+
+//------------------------------------------------------------------------------
+// コンストラクタ
+//------------------------------------------------------------------------------
+IntegralImage::IntegralImage(const Image& image, bool squared) {
+
+    width  = image.Width();
+    height = image.Height();
+
+    Build(image, table, false);
+    if(squared) {
+        Build(image, squaredTable, true);
+    }
+}
+
+//------------------------------------------------------------------------------
+// 表を作る
+//
+// MEMO:
+// 1パス目は行ごとの累積和 (行単位で並列), 2パス目は列方向の累積和
+// (列の範囲ごとに並列, 内側のループは行内で連続するのでベクトル化できる)
+//------------------------------------------------------------------------------
+void IntegralImage::Build(const Image& image, std::vector<long long>& table, bool squared) {
+
+    int stride = (width+1)*3;
+    table.assign((size_t)stride * (height+1), 0);
+
+    // 横方向
+    TablePass rows(height, [&](int start, int length) {
+        for(int iY=start; iY<start+length; iY++) {
+            const unsigned char* src = (const unsigned char*)&image.data[iY*width];
+            long long* dst = &table[(size_t)stride*(iY+1)];
+            for(int p=0; p<width*3; p++) {
+                long long value = squared ? src[p]*src[p] : src[p];
+                dst[p+3] = dst[p] + value;
+            }
+        }
+    });
+
+    // 縦方向
+    TablePass columns(stride, [&](int start, int length) {
+        for(int iY=1; iY<=height; iY++) {
+            const long long* above = &table[(size_t)stride*(iY-1)];
+            long long*       dst   = &table[(size_t)stride*iY];
+            for(int p=start; p<start+length; p++) {
+                dst[p] += above[p];
+            }
+        }
+    });
+}
+
+//------------------------------------------------------------------------------
+// 矩形の画素数
+//------------------------------------------------------------------------------
+int IntegralImage::Count(int x0, int y0, int x1, int y1) const {
+    x0 = std::max(x0, 0); x1 = std::min(x1, width);
+    y0 = std::max(y0, 0); y1 = std::min(y1, height);
+    if(x0 >= x1 || y0 >= y1) return 0;
+    return (x1-x0) * (y1-y0);
+}
+
+//------------------------------------------------------------------------------
+// 矩形の合計
+//------------------------------------------------------------------------------
+IntegralImage::Total IntegralImage::RectSum(const std::vector<long long>& table,
+                                            int x0, int y0, int x1, int y1) const {
+    Total total;
+
+    x0 = std::max(x0, 0); x1 = std::min(x1, width);
+    y0 = std::max(y0, 0); y1 = std::min(y1, height);
+    if(x0 >= x1 || y0 >= y1 || table.empty()) return total;
+
+    int stride = (width+1)*3;
+    const long long* top    = &table[(size_t)stride*y0];
+    const long long* bottom = &table[(size_t)stride*y1];
+
+    total.r = bottom[x1*3+0] - bottom[x0*3+0] - top[x1*3+0] + top[x0*3+0];
+    total.g = bottom[x1*3+1] - bottom[x0*3+1] - top[x1*3+1] + top[x0*3+1];
+    total.b = bottom[x1*3+2] - bottom[x0*3+2] - top[x1*3+2] + top[x0*3+2];
+    return total;
+}
+
+}
@@ -0,0 +1,76 @@
+//==============================================================================
+//
+// 積分画像 (Summed-area table)
+//
+//==============================================================================
+#ifndef _MI_INTEGRAL_IMAGE_H_
+#define _MI_INTEGRAL_IMAGE_H_
+
+#include "miImage.h"
+#include <vector>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 積分画像
+//
+// MEMO:
+// 左上からの画素値の合計を (幅+1)x(高さ+1) の表に持ち、任意の矩形の合計を
+// 4回の参照で求める。squared を指定すると2乗和の表も作る (局所分散用)
+// 合計は 64bit なので画像サイズによらず桁あふれしない
+//------------------------------------------------------------------------------
+class IntegralImage {
+public:
+
+    // チャンネルごとの合計
+    struct Total {
+        long long r = 0;
+        long long g = 0;
+        long long b = 0;
+    };
+
+    //--------------------------------------------------------------------------
+    // コンストラクタ
+    //--------------------------------------------------------------------------
+    IntegralImage(const Image& image, bool squared = false);
+
+
+    //--------------------------------------------------------------------------
+    // Getter
+    //--------------------------------------------------------------------------
+    int Width()  const { return width; }
+    int Height() const { return height; }
+    bool HasSquared() const { return !squaredTable.empty(); }
+
+
+    //--------------------------------------------------------------------------
+    // 矩形 [x0,x1) x [y0,y1) の集計 (画像外の部分は切り詰める)
+    //--------------------------------------------------------------------------
+
+    // 画素数
+    int Count(int x0, int y0, int x1, int y1) const;
+
+    // 合計
+    Total Sum(int x0, int y0, int x1, int y1) const {
+        return RectSum(table, x0, y0, x1, y1);
+    }
+
+    // 2乗和 (squared を指定して作ったときのみ)
+    Total SquaredSum(int x0, int y0, int x1, int y1) const {
+        return RectSum(squaredTable, x0, y0, x1, y1);
+    }
+
+private:
+    int width  = 0;
+    int height = 0;
+
+    std::vector<long long> table;        // 合計の表 (行ごとに (width+1)*3)
+    std::vector<long long> squaredTable; // 2乗和の表
+
+    void Build(const Image& image, std::vector<long long>& table, bool squared);
+    Total RectSum(const std::vector<long long>& table, int x0, int y0, int x1, int y1) const;
+};
+
+}
+
+#endif
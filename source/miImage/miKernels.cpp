@@ -0,0 +1,82 @@
+//==============================================================================
+//
+// 命令セットごとのカーネル (選択)
+//
+//==============================================================================
+#include "miKernels.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MI_KERNELS_X86
+#endif
+
+namespace mi {
+
+namespace {
+
+struct Candidate {
+    const Kernels* kernels;
+    bool supported;
+};
+
+//------------------------------------------------------------------------------
+// 命令セットの候補 (優先度の高い順)
+//------------------------------------------------------------------------------
+void GetCandidates(Candidate* candidates) {
+#ifdef MI_KERNELS_X86
+    __builtin_cpu_init();
+    candidates[0] = { &KernelsAVX512, __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") };
+    candidates[1] = { &KernelsAVX2,   (bool)__builtin_cpu_supports("avx2") };
+    candidates[2] = { &KernelsSSE4,   (bool)__builtin_cpu_supports("sse4.2") };
+#else
+    candidates[0] = { &KernelsAVX512, false };
+    candidates[1] = { &KernelsAVX2,   false };
+    candidates[2] = { &KernelsSSE4,   false };
+#endif
+    candidates[3] = { &KernelsSSE2,   true };
+}
+
+//------------------------------------------------------------------------------
+// 使用するカーネル表を決める
+//------------------------------------------------------------------------------
+const Kernels* SelectKernels() {
+
+    Candidate candidates[4];
+    GetCandidates(candidates);
+
+    // 環境変数での指定
+    const char* name = std::getenv("MI_IMAGE_ISA");
+    if(name != nullptr && name[0] != '\0') {
+        for(const auto& candidate : candidates) {
+            if(std::strcmp(name, candidate.kernels->name) != 0) continue;
+            if(candidate.supported) return candidate.kernels;
+            std::cerr<<"Warning: MI_IMAGE_ISA="<<name<<" Is Not Supported By This CPU"<<std::endl;
+            name = nullptr;
+            break;
+        }
+        if(name != nullptr) {
+            std::cerr<<"Warning: Unknown MI_IMAGE_ISA="<<name<<std::endl;
+        }
+    }
+
+    // 対応している中で最も優先度の高いもの
+    for(const auto& candidate : candidates) {
+        if(candidate.supported) return candidate.kernels;
+    }
+    return &KernelsSSE2;
+}
+
+}
+
+//------------------------------------------------------------------------------
+// 使用するカーネル表
+//------------------------------------------------------------------------------
+const Kernels& CurrentKernels() {
+    static const Kernels* kernels = SelectKernels();
+    return *kernels;
+}
+
+}
@@ -0,0 +1,89 @@
+//==============================================================================
+//
+// 命令セットごとのカーネル
+//
+//==============================================================================
+#ifndef _MI_KERNELS_H_
+#define _MI_KERNELS_H_
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 命令セットごとのカーネル表
+//
+// MEMO:
+// 処理の重いループを miKernels.inl に書き、miKernelsSSE2.cpp, miKernelsSSE4.cpp,
+// miKernelsAVX2.cpp, miKernelsAVX512.cpp でそれぞれの命令セットを有効にして
+// コンパイルする (makefile でファイルごとに -m オプションを指定している)
+// どの表を使うかは最初の CurrentKernels() で CPUID から決める
+// 環境変数 MI_IMAGE_ISA に sse2, sse4, avx2, avx512 を指定すると、その表を使う
+// (CPU が対応していない場合は警告を出して自動で選んだ表を使う)
+// 画素は RGB の並びのバイト列として渡す
+//------------------------------------------------------------------------------
+struct Kernels {
+    const char* name; // 命令セットの名前 (MI_IMAGE_ISA に指定する名前)
+
+    // 輝度 (miLuma.h)
+    void (*toLuma)(const unsigned char* rgb, unsigned char* luma, int count);
+    void (*fromLuma)(const unsigned char* luma, unsigned char* rgb, int count);
+
+    // Gaussian フィルタ (固定小数点) の縦方向の畳み込み
+    void (*convolveVerticalQ14)(const short* const* rows, const short* weights, int taps, unsigned char* dst, int count);
+
+    // メディアンフィルタ (ソーティングネットワーク) の列のソートと中央値の選択
+    void (*sortColumns3)(const unsigned char* const* src, unsigned char* const* sorted, int begin, int end);
+    void (*selectMedians3)(unsigned char* const* sorted, unsigned char* dst, int begin, int end);
+    void (*sortColumns5)(const unsigned char* const* src, unsigned char* const* sorted, int begin, int end);
+    void (*selectMedians5)(unsigned char* const* sorted, unsigned char* dst, int begin, int end);
+
+    // Windows Bitmap の画素の並べ替え (BGR <-> RGB, BGRA <-> RGB + アルファ)
+    void (*swapRB)(const unsigned char* src, unsigned char* dst, int count);
+    void (*unpackBGRA)(const unsigned char* src, unsigned char* rgb, unsigned char* alpha, int count);
+    void (*packBGRA)(const unsigned char* rgb, const unsigned char* alpha, unsigned char* dst, int count);
+
+    // アルファブレンド dst = (a*src + (255-a)*dst + 127) / 255
+    // (a は画素ごとの alpha と opacity (0..255) の積を 255 で割ったもの, alpha が nullptr なら opacity)
+    void (*blend)(const unsigned char* src, const unsigned char* alpha, int opacity, unsigned char* dst, int count);
+
+    // チャンネルごとの参照テーブルの適用 dst[i*3+c] = tables[c][src[i*3+c]] (src と dst は同じでもよい)
+    void (*applyTables)(const unsigned char* src, const unsigned char (*tables)[256], unsigned char* dst, int count);
+
+    // 畳み込みエンジン (miConvolution.h) の内側の積和
+    // Sobel X, Y の組と Laplacian (3x3, 16bit), 大きさが実行時に決まる double のカーネル
+    void (*accumulateSobel)(short* const* sums, const unsigned char* const* rows, const short* const* weights,
+                            int kw, int kh, int cx, int channels, int begin, int end);
+    void (*accumulateLaplacian)(short* const* sums, const unsigned char* const* rows, const short* const* weights,
+                                int kw, int kh, int cx, int channels, int begin, int end);
+    void (*accumulateDouble)(double* const* sums, const unsigned char* const* rows, const double* const* weights,
+                             int kw, int kh, int cx, int channels, int begin, int end);
+
+    // Sobel, Laplacian フィルタの内側 (a, b, c は上・中・下の行, RGB の要素の区間 [begin, end))
+    // 積和と変換をまとめて dst に書く (gradientX, gradientY は nullptr なら書き込まない)
+    void (*sobelInterior)(const unsigned char* a, const unsigned char* b, const unsigned char* c,
+                          int begin, int end, unsigned char* dst, short* gradientX, short* gradientY);
+    void (*laplacianInterior)(const unsigned char* a, const unsigned char* b, const unsigned char* c,
+                              int begin, int end, unsigned char* dst);
+
+    // 箱型カーネルの列ごとの窓の合計に行を足す・引く
+    void (*addColumns)(int* column, const unsigned char* src, int count);
+    void (*subtractColumns)(int* column, const unsigned char* src, int count);
+
+    // 画像内の画素数で割る平均 dst[x] = sums[x] / counts[x] を四捨五入したもの (RGB ごと, x = 0..width-1)
+    void (*averageRow)(const int* sums, const int* counts, unsigned char* dst, int width);
+};
+
+// 使用するカーネル表
+const Kernels& CurrentKernels();
+
+// 命令セットごとのカーネル表
+extern const Kernels KernelsSSE2;
+extern const Kernels KernelsSSE4;
+extern const Kernels KernelsAVX2;
+extern const Kernels KernelsAVX512;
+
+// Gaussian フィルタ (固定小数点) のマスクの小数部のbit数
+const int GaussianWeightBits = 14;
+
+}
+
+#endif
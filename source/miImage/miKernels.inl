@@ -0,0 +1,777 @@
+//==============================================================================
+//
+// 命令セットごとのカーネル (本体)
+//
+// MEMO:
+// miKernelsSSE2.cpp などから MI_KERNELS_NAME (命令セットの名前) と
+// MI_KERNELS_TABLE (カーネル表の変数名) を定義して include する
+// 翻訳単位ごとに異なる命令セットでコンパイルされるので、関数はすべて無名名前空間に置き、
+// ヘッダのインライン関数や std のテンプレートは呼ばない
+// (リンカがどの翻訳単位の実体を選ぶか決まらず、CPU が対応していない命令が混ざるため)
+// 畳み込みエンジン (miConvolution.h) のテンプレートは、無名名前空間の型 IsaTag を
+// Isa に渡して実体化する (翻訳単位ごとに別の実体になる)
+//
+//==============================================================================
+#include "miKernels.h"
+#include "miLuma.h"
+#include "miConvolution.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#if defined(__AVX2__) || defined(__AVX512BW__)
+#include <immintrin.h>
+#endif
+
+namespace mi {
+
+namespace {
+
+inline int ClampByte(int a) { return a < 0 ? 0 : (a > 255 ? 255 : a); }
+
+// 畳み込みエンジンのテンプレートをこの翻訳単位で実体化するための型
+struct IsaTag {};
+
+//------------------------------------------------------------------------------
+// 輝度
+//------------------------------------------------------------------------------
+void ToLuma(const unsigned char* src, unsigned char* dst, int count) {
+
+    int i = 0;
+
+#ifdef __SSSE3__
+    // 4画素 (12byte) を R,G と G,B の 16bit の組に並べる
+    const __m128i shuffleRG = _mm_setr_epi8(0,-1, 1,-1, 3,-1, 4,-1, 6,-1, 7,-1,  9,-1, 10,-1);
+    const __m128i shuffleGB = _mm_setr_epi8(1,-1, 2,-1, 4,-1, 5,-1, 7,-1, 8,-1, 10,-1, 11,-1);
+
+    // G の係数は 16bit の符号付きに収まらないので半分ずつ両方の組に持たせる
+    const __m128i weightRG = _mm_set1_epi32(LumaR | ((LumaG/2) << 16));
+    const __m128i weightGB = _mm_set1_epi32((LumaG - LumaG/2) | (LumaB << 16));
+#endif
+
+#ifdef __AVX2__
+    // 4画素ずつの窓を2つ並べて 8画素ずつ計算する (pshufb は 128bit の中でしか動かせないため)
+    {
+        const __m256i shuffleRG2 = _mm256_broadcastsi128_si256(shuffleRG);
+        const __m256i shuffleGB2 = _mm256_broadcastsi128_si256(shuffleGB);
+        const __m256i weightRG2  = _mm256_broadcastsi128_si256(weightRG);
+        const __m256i weightGB2  = _mm256_broadcastsi128_si256(weightGB);
+        const __m256i order      = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+        for(; i+32<=count; i+=32) {
+            const unsigned char* p = &src[i*3];
+            __m256i windows[4] = {
+                _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p))),
+                                        _mm_loadu_si128((const __m128i*)(p+12)), 1),
+                _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p+24))),
+                                        _mm_loadu_si128((const __m128i*)(p+36)), 1),
+                _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p+48))),
+                                        _mm_loadu_si128((const __m128i*)(p+60)), 1),
+                _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p+72))),
+                                        _mm_srli_si128(_mm_loadu_si128((const __m128i*)(p+80)), 4), 1),
+            };
+
+            __m256i Y[4];
+            for(int k=0; k<4; k++) {
+                __m256i sum = _mm256_add_epi32(
+                    _mm256_madd_epi16(_mm256_shuffle_epi8(windows[k], shuffleRG2), weightRG2),
+                    _mm256_madd_epi16(_mm256_shuffle_epi8(windows[k], shuffleGB2), weightGB2));
+                Y[k] = _mm256_srli_epi32(sum, LumaShift);
+            }
+
+            // 128bit ごとに詰めると窓の順序が入れ替わるので 32bit 単位で並べ直す
+            __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(Y[0], Y[1]), _mm256_packs_epi32(Y[2], Y[3]));
+            _mm256_storeu_si256((__m256i*)&dst[i], _mm256_permutevar8x32_epi32(packed, order));
+        }
+    }
+#endif
+
+#ifdef __SSSE3__
+    for(; i+16<=count; i+=16) {
+        const __m128i* p = (const __m128i*)&src[i*3];
+        __m128i v0 = _mm_loadu_si128(p);
+        __m128i v1 = _mm_loadu_si128(p+1);
+        __m128i v2 = _mm_loadu_si128(p+2);
+
+        // 4画素ずつの窓 (先頭の 12byte を使う)
+        __m128i windows[4] = {
+            v0,
+            _mm_alignr_epi8(v1, v0, 12),
+            _mm_alignr_epi8(v2, v1, 8),
+            _mm_srli_si128(v2, 4),
+        };
+
+        __m128i Y[4];
+        for(int k=0; k<4; k++) {
+            __m128i sum = _mm_add_epi32(
+                _mm_madd_epi16(_mm_shuffle_epi8(windows[k], shuffleRG), weightRG),
+                _mm_madd_epi16(_mm_shuffle_epi8(windows[k], shuffleGB), weightGB));
+            Y[k] = _mm_srli_epi32(sum, LumaShift);
+        }
+
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(Y[0], Y[1]), _mm_packs_epi32(Y[2], Y[3]));
+        _mm_storeu_si128((__m128i*)&dst[i], packed);
+    }
+#endif
+
+    for(; i<count; i++) {
+        dst[i] = (unsigned char)((LumaR*src[i*3] + LumaG*src[i*3+1] + LumaB*src[i*3+2]) >> LumaShift);
+    }
+}
+
+void FromLuma(const unsigned char* luma, unsigned char* dst, int count) {
+
+    int i = 0;
+
+#ifdef __SSSE3__
+    const __m128i shuffle0 = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i shuffle1 = _mm_setr_epi8( 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10);
+    const __m128i shuffle2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
+
+    for(; i+16<=count; i+=16) {
+        __m128i Y = _mm_loadu_si128((const __m128i*)&luma[i]);
+        __m128i* p = (__m128i*)&dst[i*3];
+        _mm_storeu_si128(p,   _mm_shuffle_epi8(Y, shuffle0));
+        _mm_storeu_si128(p+1, _mm_shuffle_epi8(Y, shuffle1));
+        _mm_storeu_si128(p+2, _mm_shuffle_epi8(Y, shuffle2));
+    }
+#endif
+
+    for(; i<count; i++) {
+        dst[i*3] = dst[i*3+1] = dst[i*3+2] = luma[i];
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Gaussian フィルタ (固定小数点)
+//------------------------------------------------------------------------------
+
+// dst[p] = (Σ weights[j] * rows[j][p] を 2^14 で割って切り捨てたもの) (p = 0..count-1)
+void ConvolveVerticalQ14(const short* const* rows, const short* weights, int taps, unsigned char* dst, int count) {
+
+    const int shift = GaussianWeightBits;
+    int p = 0;
+
+#if defined(__AVX512BW__)
+    for(; p+32<=count; p+=32) {
+        __m512i lo = _mm512_setzero_si512();
+        __m512i hi = lo;
+        for(int j=0; j<taps; j+=2) {
+            __m512i a = _mm512_loadu_si512((const void*)(rows[j]+p));
+            __m512i b = (j+1 < taps) ? _mm512_loadu_si512((const void*)(rows[j+1]+p)) : _mm512_setzero_si512();
+            __m512i w = _mm512_set1_epi32((weights[j] & 0xFFFF) | ((j+1 < taps ? weights[j+1] : 0) << 16));
+            lo = _mm512_add_epi32(lo, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), w));
+            hi = _mm512_add_epi32(hi, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), w));
+        }
+        // 負の値を 0 にしてから符号なしの飽和で 8bit に詰める
+        __m512i v = _mm512_packs_epi32(_mm512_srai_epi32(lo, shift), _mm512_srai_epi32(hi, shift));
+        v = _mm512_max_epi16(v, _mm512_setzero_si512());
+        _mm256_storeu_si256((__m256i*)(dst+p), _mm512_cvtusepi16_epi8(v));
+    }
+#endif
+#if defined(__AVX2__)
+    for(; p+16<=count; p+=16) {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = lo;
+        for(int j=0; j<taps; j+=2) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(rows[j]+p));
+            __m256i b = (j+1 < taps) ? _mm256_loadu_si256((const __m256i*)(rows[j+1]+p)) : _mm256_setzero_si256();
+            __m256i w = _mm256_set1_epi32((weights[j] & 0xFFFF) | ((j+1 < taps ? weights[j+1] : 0) << 16));
+            lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+            hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+        }
+        __m256i v = _mm256_packs_epi32(_mm256_srai_epi32(lo, shift), _mm256_srai_epi32(hi, shift));
+        v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+        _mm_storeu_si128((__m128i*)(dst+p), _mm256_castsi256_si128(v));
+    }
+#endif
+#if defined(__SSE2__)
+    for(; p+8<=count; p+=8) {
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = lo;
+        for(int j=0; j<taps; j+=2) {
+            __m128i a = _mm_loadu_si128((const __m128i*)(rows[j]+p));
+            __m128i b = (j+1 < taps) ? _mm_loadu_si128((const __m128i*)(rows[j+1]+p)) : _mm_setzero_si128();
+            __m128i w = _mm_set1_epi32((weights[j] & 0xFFFF) | ((j+1 < taps ? weights[j+1] : 0) << 16));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+        }
+        __m128i v = _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+        _mm_storel_epi64((__m128i*)(dst+p), _mm_packus_epi16(v, v));
+    }
+#endif
+    for(; p<count; p++) {
+        int sum = 0;
+        for(int j=0; j<taps; j++) {
+            sum += weights[j] * rows[j][p];
+        }
+        dst[p] = (unsigned char)ClampByte(sum >> shift);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// メディアンフィルタ (ソーティングネットワーク)
+//------------------------------------------------------------------------------
+inline unsigned char Min(unsigned char a, unsigned char b) { return a < b ? a : b; }
+inline unsigned char Max(unsigned char a, unsigned char b) { return a < b ? b : a; }
+
+#ifdef __SSE2__
+inline __m128i Min(__m128i a, __m128i b) { return _mm_min_epu8(a, b); }
+inline __m128i Max(__m128i a, __m128i b) { return _mm_max_epu8(a, b); }
+#endif
+#ifdef __AVX2__
+inline __m256i Min(__m256i a, __m256i b) { return _mm256_min_epu8(a, b); }
+inline __m256i Max(__m256i a, __m256i b) { return _mm256_max_epu8(a, b); }
+#endif
+#ifdef __AVX512BW__
+inline __m512i Min(__m512i a, __m512i b) { return _mm512_min_epu8(a, b); }
+inline __m512i Max(__m512i a, __m512i b) { return _mm512_max_epu8(a, b); }
+#endif
+
+template<class T> inline void Sort2(T& a, T& b) {
+    T t = Min(a, b);
+    b = Max(a, b);
+    a = t;
+}
+
+// v[列*Size + 行] の並びで、各列は行方向に昇順ソート済みであること
+template<int Size> struct MedianNetwork;
+
+template<> struct MedianNetwork<3> {
+    template<class T> static void SortColumn(T* v) {
+        Sort2(v[0], v[1]); Sort2(v[1], v[2]); Sort2(v[0], v[1]);
+    }
+    // 各列の最小値の最大, 中央値の中央値, 最大値の最小 の中央値
+    template<class T> static T Median(T* v) {
+        T lo = Max(Max(v[0], v[3]), v[6]);
+        T hi = Min(Min(v[2], v[5]), v[8]);
+        Sort2(v[1], v[4]); v[4] = Min(v[4], v[7]); T mid = Max(v[1], v[4]);
+        Sort2(lo, mid); mid = Min(mid, hi);
+        return Max(lo, mid);
+    }
+};
+
+template<> struct MedianNetwork<5> {
+    template<class T> static void SortColumn(T* v) {
+        Sort2(v[0], v[1]); Sort2(v[3], v[4]); Sort2(v[2], v[4]);
+        Sort2(v[2], v[3]); Sort2(v[0], v[3]); Sort2(v[0], v[2]);
+        Sort2(v[1], v[4]); Sort2(v[1], v[3]); Sort2(v[1], v[2]);
+    }
+    // 行のソートと反対角線のソートをしたうえで、中央値に関係しない比較を省いたもの
+    // (0-1 原理で列ソート済みの全入力について検証済み)
+    template<class T> static T Median(T* v) {
+        Sort2(v[0], v[5]); Sort2(v[15], v[20]); Sort2(v[10], v[20]);
+        v[15] = Max(v[10], v[15]); v[15] = Max(v[0], v[15]); Sort2(v[5], v[20]);
+        v[15] = Max(v[5], v[15]); Sort2(v[1], v[6]); Sort2(v[16], v[21]);
+        Sort2(v[11], v[21]); Sort2(v[11], v[16]); v[16] = Max(v[1], v[16]);
+        Sort2(v[6], v[21]); Sort2(v[6], v[16]); v[11] = Max(v[6], v[11]);
+        Sort2(v[2], v[7]); Sort2(v[17], v[22]); Sort2(v[12], v[22]);
+        Sort2(v[12], v[17]); Sort2(v[2], v[17]); v[12] = Max(v[2], v[12]);
+        v[7] = Min(v[7], v[22]); Sort2(v[7], v[17]); Sort2(v[7], v[12]);
+        Sort2(v[3], v[8]); Sort2(v[18], v[23]); Sort2(v[13], v[18]);
+        Sort2(v[3], v[18]); Sort2(v[3], v[13]); v[8] = Min(v[8], v[23]);
+        v[8] = Min(v[8], v[18]); Sort2(v[8], v[13]); Sort2(v[4], v[9]);
+        Sort2(v[19], v[24]); v[14] = Min(v[14], v[24]); Sort2(v[14], v[19]);
+        v[4] = Min(v[4], v[19]); Sort2(v[4], v[14]); Sort2(v[9], v[14]);
+        v[7] = Max(v[3], v[7]); Sort2(v[11], v[15]); v[15] = Max(v[7], v[15]);
+        Sort2(v[4], v[8]); Sort2(v[12], v[16]); v[12] = Max(v[4], v[12]);
+        v[8] = Min(v[8], v[16]); Sort2(v[8], v[12]); v[12] = Min(v[12], v[20]);
+        v[12] = Max(v[8], v[12]); v[17] = Min(v[17], v[21]); v[9] = Min(v[9], v[17]);
+        v[14] = Min(v[14], v[15]); v[11] = Max(v[9], v[11]); Sort2(v[12], v[14]);
+        v[13] = Min(v[13], v[14]); v[11] = Min(v[11], v[13]); v[12] = Max(v[11], v[12]);
+        return v[12];
+    }
+};
+
+// 1行分のバイト [begin, end) について列のソートをおこなう
+// src[k] は k 行目の先頭, sorted[k] は列をソートした k 番目の値の書き込み先
+template<int Size> void SortColumns(const unsigned char* const* src, unsigned char* const* sorted, int begin, int end) {
+    int p = begin;
+#ifdef __AVX512BW__
+    for(; p+64<=end; p+=64) {
+        __m512i v[Size];
+        for(int k=0; k<Size; k++) v[k] = _mm512_loadu_si512((const void*)(src[k]+p));
+        MedianNetwork<Size>::SortColumn(v);
+        for(int k=0; k<Size; k++) _mm512_storeu_si512((void*)(sorted[k]+p), v[k]);
+    }
+#endif
+#ifdef __AVX2__
+    for(; p+32<=end; p+=32) {
+        __m256i v[Size];
+        for(int k=0; k<Size; k++) v[k] = _mm256_loadu_si256((const __m256i*)(src[k]+p));
+        MedianNetwork<Size>::SortColumn(v);
+        for(int k=0; k<Size; k++) _mm256_storeu_si256((__m256i*)(sorted[k]+p), v[k]);
+    }
+#endif
+#ifdef __SSE2__
+    for(; p+16<=end; p+=16) {
+        __m128i v[Size];
+        for(int k=0; k<Size; k++) v[k] = _mm_loadu_si128((const __m128i*)(src[k]+p));
+        MedianNetwork<Size>::SortColumn(v);
+        for(int k=0; k<Size; k++) _mm_storeu_si128((__m128i*)(sorted[k]+p), v[k]);
+    }
+#endif
+    for(; p<end; p++) {
+        unsigned char v[Size];
+        for(int k=0; k<Size; k++) v[k] = src[k][p];
+        MedianNetwork<Size>::SortColumn(v);
+        for(int k=0; k<Size; k++) sorted[k][p] = v[k];
+    }
+}
+
+// 1行分のバイト [begin, end) について中央値を求める
+template<int Size> void SelectMedians(unsigned char* const* sorted, unsigned char* dst, int begin, int end) {
+    const int half = Size/2;
+    int p = begin;
+#ifdef __AVX512BW__
+    for(; p+64<=end; p+=64) {
+        __m512i v[Size*Size];
+        for(int j=0; j<Size; j++) {
+            for(int k=0; k<Size; k++) v[j*Size+k] = _mm512_loadu_si512((const void*)(sorted[k]+p+(j-half)*3));
+        }
+        _mm512_storeu_si512((void*)(dst+p), MedianNetwork<Size>::Median(v));
+    }
+#endif
+#ifdef __AVX2__
+    for(; p+32<=end; p+=32) {
+        __m256i v[Size*Size];
+        for(int j=0; j<Size; j++) {
+            for(int k=0; k<Size; k++) v[j*Size+k] = _mm256_loadu_si256((const __m256i*)(sorted[k]+p+(j-half)*3));
+        }
+        _mm256_storeu_si256((__m256i*)(dst+p), MedianNetwork<Size>::Median(v));
+    }
+#endif
+#ifdef __SSE2__
+    for(; p+16<=end; p+=16) {
+        __m128i v[Size*Size];
+        for(int j=0; j<Size; j++) {
+            for(int k=0; k<Size; k++) v[j*Size+k] = _mm_loadu_si128((const __m128i*)(sorted[k]+p+(j-half)*3));
+        }
+        _mm_storeu_si128((__m128i*)(dst+p), MedianNetwork<Size>::Median(v));
+    }
+#endif
+    for(; p<end; p++) {
+        unsigned char v[Size*Size];
+        for(int j=0; j<Size; j++) {
+            for(int k=0; k<Size; k++) v[j*Size+k] = sorted[k][p+(j-half)*3];
+        }
+        dst[p] = MedianNetwork<Size>::Median(v);
+    }
+}
+
+
+//------------------------------------------------------------------------------
+// Windows Bitmap の画素の並べ替え
+//------------------------------------------------------------------------------
+
+// BGR <-> RGB (src と dst は同じでもよい)
+void SwapRB(const unsigned char* src, unsigned char* dst, int count) {
+
+    int i = 0;
+
+#ifdef __SSSE3__
+    // 16byte 読んで先頭の5画素を入れ替える (16byte 目は読んだ値をそのまま書く)
+    const __m128i shuffle = _mm_setr_epi8(2,1,0, 5,4,3, 8,7,6, 11,10,9, 14,13,12, 15);
+    for(; i+6<=count; i+=5) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&src[i*3]);
+        _mm_storeu_si128((__m128i*)&dst[i*3], _mm_shuffle_epi8(v, shuffle));
+    }
+#endif
+
+    for(; i<count; i++) {
+        unsigned char b = src[i*3+0];
+        unsigned char g = src[i*3+1];
+        unsigned char r = src[i*3+2];
+        dst[i*3+0] = r;
+        dst[i*3+1] = g;
+        dst[i*3+2] = b;
+    }
+}
+
+// BGRA -> RGB + アルファ (alpha は nullptr なら書き込まない)
+void UnpackBGRA(const unsigned char* src, unsigned char* rgb, unsigned char* alpha, int count) {
+
+    int i = 0;
+
+#ifdef __SSSE3__
+    // 4画素ずつ RGB の 12byte を先頭に詰め、ずらして 48byte につなぐ
+    const __m128i shuffleRGB   = _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12, -1,-1,-1,-1);
+    const __m128i shuffleAlpha = _mm_setr_epi8(3,7,11,15, -1,-1,-1,-1, -1,-1,-1,-1, -1,-1,-1,-1);
+    for(; i+16<=count; i+=16) {
+        const __m128i* p = (const __m128i*)&src[i*4];
+        __m128i v[4], c[4];
+        for(int k=0; k<4; k++) {
+            v[k] = _mm_loadu_si128(p+k);
+            c[k] = _mm_shuffle_epi8(v[k], shuffleRGB);
+        }
+        __m128i* q = (__m128i*)&rgb[i*3];
+        _mm_storeu_si128(q,   _mm_or_si128(c[0], _mm_slli_si128(c[1], 12)));
+        _mm_storeu_si128(q+1, _mm_or_si128(_mm_srli_si128(c[1], 4), _mm_slli_si128(c[2], 8)));
+        _mm_storeu_si128(q+2, _mm_or_si128(_mm_srli_si128(c[2], 8), _mm_slli_si128(c[3], 4)));
+
+        if(alpha != nullptr) {
+            __m128i a = _mm_or_si128(
+                _mm_or_si128(_mm_shuffle_epi8(v[0], shuffleAlpha), _mm_slli_si128(_mm_shuffle_epi8(v[1], shuffleAlpha), 4)),
+                _mm_or_si128(_mm_slli_si128(_mm_shuffle_epi8(v[2], shuffleAlpha), 8), _mm_slli_si128(_mm_shuffle_epi8(v[3], shuffleAlpha), 12)));
+            _mm_storeu_si128((__m128i*)&alpha[i], a);
+        }
+    }
+#endif
+
+    for(; i<count; i++) {
+        rgb[i*3+0] = src[i*4+2];
+        rgb[i*3+1] = src[i*4+1];
+        rgb[i*3+2] = src[i*4+0];
+        if(alpha != nullptr) alpha[i] = src[i*4+3];
+    }
+}
+
+// RGB + アルファ -> BGRA (alpha が nullptr ならアルファは 0)
+void PackBGRA(const unsigned char* rgb, const unsigned char* alpha, unsigned char* dst, int count) {
+
+    int i = 0;
+
+#ifdef __SSSE3__
+    // 48byte を 4画素ずつの窓に分け、BGR と空きのアルファに並べてからアルファを入れる
+    const __m128i shuffleBGR = _mm_setr_epi8(2,1,0,-1, 5,4,3,-1, 8,7,6,-1, 11,10,9,-1);
+    const __m128i shuffleAlpha[4] = {
+        _mm_setr_epi8(-1,-1,-1, 0, -1,-1,-1, 1, -1,-1,-1, 2, -1,-1,-1, 3),
+        _mm_setr_epi8(-1,-1,-1, 4, -1,-1,-1, 5, -1,-1,-1, 6, -1,-1,-1, 7),
+        _mm_setr_epi8(-1,-1,-1, 8, -1,-1,-1, 9, -1,-1,-1,10, -1,-1,-1,11),
+        _mm_setr_epi8(-1,-1,-1,12, -1,-1,-1,13, -1,-1,-1,14, -1,-1,-1,15),
+    };
+    for(; i+16<=count; i+=16) {
+        const __m128i* p = (const __m128i*)&rgb[i*3];
+        __m128i v0 = _mm_loadu_si128(p);
+        __m128i v1 = _mm_loadu_si128(p+1);
+        __m128i v2 = _mm_loadu_si128(p+2);
+        __m128i windows[4] = {
+            v0,
+            _mm_alignr_epi8(v1, v0, 12),
+            _mm_alignr_epi8(v2, v1, 8),
+            _mm_srli_si128(v2, 4),
+        };
+        __m128i a = (alpha != nullptr) ? _mm_loadu_si128((const __m128i*)&alpha[i]) : _mm_setzero_si128();
+
+        __m128i* q = (__m128i*)&dst[i*4];
+        for(int k=0; k<4; k++) {
+            __m128i bgra = _mm_or_si128(_mm_shuffle_epi8(windows[k], shuffleBGR), _mm_shuffle_epi8(a, shuffleAlpha[k]));
+            _mm_storeu_si128(q+k, bgra);
+        }
+    }
+#endif
+
+    for(; i<count; i++) {
+        dst[i*4+0] = rgb[i*3+2];
+        dst[i*4+1] = rgb[i*3+1];
+        dst[i*4+2] = rgb[i*3+0];
+        dst[i*4+3] = alpha ? alpha[i] : 0;
+    }
+}
+
+
+
+//------------------------------------------------------------------------------
+// アルファブレンド
+//
+// MEMO:
+// 0..65534 の t について t/255 の切り捨ては (t + 1 + (t >> 8)) >> 8 に等しい
+// a*x + (255-a)*y + 127 は 16bit に収まるので、16bit 整数のまま除算まで済む
+//------------------------------------------------------------------------------
+inline int Div255(int t) { return (t + 1 + (t >> 8)) >> 8; }
+
+inline unsigned char BlendByte(int x, int y, int a) {
+    return (unsigned char)Div255(a*x + (255-a)*y + 127);
+}
+
+#ifdef __SSE2__
+inline __m128i Div255(__m128i t) {
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, _mm_set1_epi16(1)), _mm_srli_epi16(t, 8)), 8);
+}
+
+// 16bit ごとの (a*x + (255-a)*y + 127) / 255
+inline __m128i BlendWords(__m128i x, __m128i y, __m128i a) {
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(a, x), _mm_mullo_epi16(_mm_sub_epi16(_mm_set1_epi16(255), a), y));
+    return Div255(_mm_add_epi16(t, _mm_set1_epi16(127)));
+}
+
+// 16byte のブレンド (a はバイトごとのアルファ)
+inline __m128i BlendBytes(__m128i x, __m128i y, __m128i a) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = BlendWords(_mm_unpacklo_epi8(x, zero), _mm_unpacklo_epi8(y, zero), _mm_unpacklo_epi8(a, zero));
+    __m128i hi = BlendWords(_mm_unpackhi_epi8(x, zero), _mm_unpackhi_epi8(y, zero), _mm_unpackhi_epi8(a, zero));
+    return _mm_packus_epi16(lo, hi);
+}
+#endif
+
+#ifdef __AVX2__
+inline __m256i Div255(__m256i t) {
+    return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(t, _mm256_set1_epi16(1)), _mm256_srli_epi16(t, 8)), 8);
+}
+
+inline __m256i BlendWords(__m256i x, __m256i y, __m256i a) {
+    __m256i t = _mm256_add_epi16(_mm256_mullo_epi16(a, x), _mm256_mullo_epi16(_mm256_sub_epi16(_mm256_set1_epi16(255), a), y));
+    return Div255(_mm256_add_epi16(t, _mm256_set1_epi16(127)));
+}
+
+// 32byte のブレンド (unpack と pack はどちらも 128bit ごとなので並びは変わらない)
+inline __m256i BlendBytes(__m256i x, __m256i y, __m256i a) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i lo = BlendWords(_mm256_unpacklo_epi8(x, zero), _mm256_unpacklo_epi8(y, zero), _mm256_unpacklo_epi8(a, zero));
+    __m256i hi = BlendWords(_mm256_unpackhi_epi8(x, zero), _mm256_unpackhi_epi8(y, zero), _mm256_unpackhi_epi8(a, zero));
+    return _mm256_packus_epi16(lo, hi);
+}
+#endif
+
+void Blend(const unsigned char* src, const unsigned char* alpha, int opacity, unsigned char* dst, int count) {
+
+    // 全体で同じアルファ (チャンネルの区別がないのでバイト列として処理する)
+    if(alpha == nullptr) {
+        int n = count*3;
+        int p = 0;
+#ifdef __AVX2__
+        const __m256i a32 = _mm256_set1_epi8((char)opacity);
+        for(; p+32<=n; p+=32) {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(src+p));
+            __m256i y = _mm256_loadu_si256((const __m256i*)(dst+p));
+            _mm256_storeu_si256((__m256i*)(dst+p), BlendBytes(x, y, a32));
+        }
+#endif
+#ifdef __SSE2__
+        const __m128i a16 = _mm_set1_epi8((char)opacity);
+        for(; p+16<=n; p+=16) {
+            __m128i x = _mm_loadu_si128((const __m128i*)(src+p));
+            __m128i y = _mm_loadu_si128((const __m128i*)(dst+p));
+            _mm_storeu_si128((__m128i*)(dst+p), BlendBytes(x, y, a16));
+        }
+#endif
+        for(; p<n; p++) {
+            dst[p] = BlendByte(src[p], dst[p], opacity);
+        }
+        return;
+    }
+
+    int i = 0;
+
+#ifdef __SSSE3__
+    // 16画素分のアルファを pshufb で 48byte に広げる (FromLuma と同じ並べ方)
+    const __m128i shuffle0 = _mm_setr_epi8( 0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+    const __m128i shuffle1 = _mm_setr_epi8( 5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9,10,10);
+    const __m128i shuffle2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,14,14,14,15,15,15);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i scale = _mm_set1_epi16((short)opacity);
+    const __m128i round = _mm_set1_epi16(127);
+
+    for(; i+16<=count; i+=16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)&alpha[i]);
+        if(opacity != 255) {
+            __m128i lo = Div255(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), scale), round));
+            __m128i hi = Div255(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), scale), round));
+            a = _mm_packus_epi16(lo, hi);
+        }
+        const __m128i* x = (const __m128i*)&src[i*3];
+        __m128i* y = (__m128i*)&dst[i*3];
+        _mm_storeu_si128(y,   BlendBytes(_mm_loadu_si128(x),   _mm_loadu_si128(y),   _mm_shuffle_epi8(a, shuffle0)));
+        _mm_storeu_si128(y+1, BlendBytes(_mm_loadu_si128(x+1), _mm_loadu_si128(y+1), _mm_shuffle_epi8(a, shuffle1)));
+        _mm_storeu_si128(y+2, BlendBytes(_mm_loadu_si128(x+2), _mm_loadu_si128(y+2), _mm_shuffle_epi8(a, shuffle2)));
+    }
+#endif
+
+    for(; i<count; i++) {
+        int a = Div255(alpha[i]*opacity + 127);
+        dst[i*3+0] = BlendByte(src[i*3+0], dst[i*3+0], a);
+        dst[i*3+1] = BlendByte(src[i*3+1], dst[i*3+1], a);
+        dst[i*3+2] = BlendByte(src[i*3+2], dst[i*3+2], a);
+    }
+}
+
+//------------------------------------------------------------------------------
+// 参照テーブルの適用
+//------------------------------------------------------------------------------
+void ApplyTables(const unsigned char* src, const unsigned char (*tables)[256], unsigned char* dst, int count) {
+
+    const unsigned char* R = tables[0];
+    const unsigned char* G = tables[1];
+    const unsigned char* B = tables[2];
+
+    // 4画素ずつ読んでから書く (src と dst が同じでも先に読んだ値を使う)
+    int i = 0;
+    for(; i+4<=count; i+=4) {
+        const unsigned char* s = &src[i*3];
+        unsigned char v[12] = {
+            R[s[0]], G[s[1]], B[s[2]],  R[s[3]], G[s[4]],  B[s[5]],
+            R[s[6]], G[s[7]], B[s[8]],  R[s[9]], G[s[10]], B[s[11]],
+        };
+        for(int k=0; k<12; k++) dst[i*3+k] = v[k];
+    }
+    for(; i<count; i++) {
+        dst[i*3+0] = R[src[i*3+0]];
+        dst[i*3+1] = G[src[i*3+1]];
+        dst[i*3+2] = B[src[i*3+2]];
+    }
+}
+
+//------------------------------------------------------------------------------
+// Sobel, Laplacian フィルタの内側
+//------------------------------------------------------------------------------
+#ifdef __SSE2__
+// 8バイトを読み込んで 16bit に広げる
+inline __m128i LoadWiden(const unsigned char* p) {
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)p), _mm_setzero_si128());
+}
+#endif
+
+#ifdef __AVX2__
+// 16バイトを読み込んで 16bit に広げる
+inline __m256i LoadWiden16(const unsigned char* p) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)p));
+}
+
+// 16bit の 16要素を 0..255 に飽和させて 16byte 書く
+// (packus は 128bit ごとに並べるので、下位 64bit どうしを寄せる)
+inline void StoreBytes16(unsigned char* p, __m256i v) {
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+    _mm_storeu_si128((__m128i*)p, _mm256_castsi256_si128(packed));
+}
+#endif
+
+// dst[p] = min(255, sqrt(gx*gx + gy*gy)), gradientX, gradientY が nullptr でなければ gx, gy も書き込む
+void SobelInterior(const unsigned char* a, const unsigned char* b, const unsigned char* c,
+                   int begin, int end, unsigned char* dst, short* gradientX, short* gradientY) {
+    int p = begin;
+#ifdef __AVX2__
+    for(; p+16<=end; p+=16) {
+        __m256i aL = LoadWiden16(a+p-3), aC = LoadWiden16(a+p), aR = LoadWiden16(a+p+3);
+        __m256i bL = LoadWiden16(b+p-3),                        bR = LoadWiden16(b+p+3);
+        __m256i cL = LoadWiden16(c+p-3), cC = LoadWiden16(c+p), cR = LoadWiden16(c+p+3);
+        
+        __m256i bD = _mm256_sub_epi16(bR, bL);
+        __m256i gx = _mm256_add_epi16(_mm256_add_epi16(_mm256_sub_epi16(aR, aL), _mm256_sub_epi16(cR, cL)), _mm256_add_epi16(bD, bD));
+        __m256i cS = _mm256_add_epi16(_mm256_add_epi16(cL, cR), _mm256_add_epi16(cC, cC));
+        __m256i aS = _mm256_add_epi16(_mm256_add_epi16(aL, aR), _mm256_add_epi16(aC, aC));
+        __m256i gy = _mm256_sub_epi16(cS, aS);
+        
+        if(gradientX) _mm256_storeu_si256((__m256i*)(gradientX+p), gx);
+        if(gradientY) _mm256_storeu_si256((__m256i*)(gradientY+p), gy);
+        
+        // unpack と packs はどちらも 128bit ごとなので、packs の結果は要素の順に戻る
+        __m256i lo = _mm256_unpacklo_epi16(gx, gy);
+        __m256i hi = _mm256_unpackhi_epi16(gx, gy);
+        lo = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(lo, lo))));
+        hi = _mm256_cvttps_epi32(_mm256_sqrt_ps(_mm256_cvtepi32_ps(_mm256_madd_epi16(hi, hi))));
+        StoreBytes16(dst+p, _mm256_packs_epi32(lo, hi));
+    }
+#endif
+#ifdef __SSE2__
+    for(; p+8<=end; p+=8) {
+        __m128i aL = LoadWiden(a+p-3), aC = LoadWiden(a+p), aR = LoadWiden(a+p+3);
+        __m128i bL = LoadWiden(b+p-3),                      bR = LoadWiden(b+p+3);
+        __m128i cL = LoadWiden(c+p-3), cC = LoadWiden(c+p), cR = LoadWiden(c+p+3);
+        
+        __m128i bD = _mm_sub_epi16(bR, bL);
+        __m128i gx = _mm_add_epi16(_mm_add_epi16(_mm_sub_epi16(aR, aL), _mm_sub_epi16(cR, cL)), _mm_add_epi16(bD, bD));
+        __m128i cS = _mm_add_epi16(_mm_add_epi16(cL, cR), _mm_add_epi16(cC, cC));
+        __m128i aS = _mm_add_epi16(_mm_add_epi16(aL, aR), _mm_add_epi16(aC, aC));
+        __m128i gy = _mm_sub_epi16(cS, aS);
+        
+        if(gradientX) _mm_storeu_si128((__m128i*)(gradientX+p), gx);
+        if(gradientY) _mm_storeu_si128((__m128i*)(gradientY+p), gy);
+        
+        // gx*gx + gy*gy を 32bit で求めて平方根をとる
+        __m128i lo = _mm_unpacklo_epi16(gx, gy);
+        __m128i hi = _mm_unpackhi_epi16(gx, gy);
+        lo = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(lo, lo))));
+        hi = _mm_cvttps_epi32(_mm_sqrt_ps(_mm_cvtepi32_ps(_mm_madd_epi16(hi, hi))));
+        __m128i v = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i*)(dst+p), _mm_packus_epi16(v, v));
+    }
+#endif
+    for(; p<end; p++) {
+        int gx = (a[p+3] - a[p-3]) + 2*(b[p+3] - b[p-3]) + (c[p+3] - c[p-3]);
+        int gy = (c[p-3] + 2*c[p] + c[p+3]) - (a[p-3] + 2*a[p] + a[p+3]);
+        if(gradientX) gradientX[p] = (short)gx;
+        if(gradientY) gradientY[p] = (short)gy;
+        int magnitude = (int)__builtin_sqrtf((float)(gx*gx + gy*gy));
+        dst[p] = (unsigned char)(magnitude < 255 ? magnitude : 255);
+    }
+}
+
+// dst[p] = clamp(周囲8画素の和 - 8*中心, 0, 255)
+void LaplacianInterior(const unsigned char* a, const unsigned char* b, const unsigned char* c,
+                       int begin, int end, unsigned char* dst) {
+    int p = begin;
+#ifdef __AVX2__
+    for(; p+16<=end; p+=16) {
+        __m256i sum = _mm256_add_epi16(_mm256_add_epi16(LoadWiden16(a+p-3), LoadWiden16(a+p)), LoadWiden16(a+p+3));
+        sum = _mm256_add_epi16(sum, _mm256_add_epi16(LoadWiden16(b+p-3), LoadWiden16(b+p+3)));
+        sum = _mm256_add_epi16(sum, _mm256_add_epi16(_mm256_add_epi16(LoadWiden16(c+p-3), LoadWiden16(c+p)), LoadWiden16(c+p+3)));
+        StoreBytes16(dst+p, _mm256_sub_epi16(sum, _mm256_slli_epi16(LoadWiden16(b+p), 3)));
+    }
+#endif
+#ifdef __SSE2__
+    for(; p+8<=end; p+=8) {
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(LoadWiden(a+p-3), LoadWiden(a+p)), LoadWiden(a+p+3));
+        sum = _mm_add_epi16(sum, _mm_add_epi16(LoadWiden(b+p-3), LoadWiden(b+p+3)));
+        sum = _mm_add_epi16(sum, _mm_add_epi16(_mm_add_epi16(LoadWiden(c+p-3), LoadWiden(c+p)), LoadWiden(c+p+3)));
+        __m128i v = _mm_sub_epi16(sum, _mm_slli_epi16(LoadWiden(b+p), 3));
+        _mm_storel_epi64((__m128i*)(dst+p), _mm_packus_epi16(v, v));
+    }
+#endif
+    for(; p<end; p++) {
+        int v = a[p-3] + a[p] + a[p+3] + b[p-3] + b[p+3] + c[p-3] + c[p] + c[p+3] - 8*b[p];
+        dst[p] = (unsigned char)ClampByte(v);
+    }
+}
+
+//------------------------------------------------------------------------------
+// 画像内の画素数で割る平均
+//------------------------------------------------------------------------------
+void AverageRow(const int* sums, const int* counts, unsigned char* dst, int width) {
+
+    // 画素数の同じ画素の並びごとに、同じ逆数を掛ける (画像の内側は1つの並びになる)
+    int iX = 0;
+    while(iX < width) {
+        int count = counts[iX];
+        int last = iX + 1;
+        while(last < width && counts[last] == count) last++;
+        
+        float inv = 1.0f / count;
+        for(int p=iX*3; p<last*3; p++) {
+            dst[p] = (unsigned char)(sums[p] * inv + 0.5f);
+        }
+        iX = last;
+    }
+}
+
+}
+
+const Kernels MI_KERNELS_TABLE = {
+    MI_KERNELS_NAME,
+    ToLuma,
+    FromLuma,
+    ConvolveVerticalQ14,
+    SortColumns<3>,
+    SelectMedians<3>,
+    SortColumns<5>,
+    SelectMedians<5>,
+    SwapRB,
+    UnpackBGRA,
+    PackBGRA,
+    Blend,
+    ApplyTables,
+    &ConvolutionDetail::AccumulateStaticTaps<std::tuple<SobelXKernel, SobelYKernel>, IsaTag>::Run<short, unsigned char, short>,
+    &ConvolutionDetail::AccumulateStaticTaps<std::tuple<LaplacianKernel>, IsaTag>::Run<short, unsigned char, short>,
+    &ConvolutionDetail::AccumulateTaps<0, 0, IsaTag>::RunAll<double, unsigned char, double, 1>,
+    SobelInterior,
+    LaplacianInterior,
+    &ConvolutionDetail::BoxColumns<int, unsigned char, IsaTag>::Add,
+    &ConvolutionDetail::BoxColumns<int, unsigned char, IsaTag>::Subtract,
+    AverageRow,
+};
+
+}
@@ -0,0 +1,9 @@
+//==============================================================================
+//
+// 命令セットごとのカーネル (avx2)
+//
+//==============================================================================
+#define MI_KERNELS_NAME  "avx2"
+#define MI_KERNELS_TABLE KernelsAVX2
+
+#include "miKernels.inl"
@@ -0,0 +1,9 @@
+//==============================================================================
+//
+// 命令セットごとのカーネル (avx512)
+//
+//==============================================================================
+#define MI_KERNELS_NAME  "avx512"
+#define MI_KERNELS_TABLE KernelsAVX512
+
+#include "miKernels.inl"
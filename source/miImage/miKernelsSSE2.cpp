@@ -0,0 +1,9 @@
+//==============================================================================
+//
+// 命令セットごとのカーネル (sse2)
+//
+//==============================================================================
+#define MI_KERNELS_NAME  "sse2"
+#define MI_KERNELS_TABLE KernelsSSE2
+
+#include "miKernels.inl"
@@ -0,0 +1,9 @@
+//==============================================================================
+//
+// 命令セットごとのカーネル (sse4)
+//
+//==============================================================================
+#define MI_KERNELS_NAME  "sse4"
+#define MI_KERNELS_TABLE KernelsSSE4
+
+#include "miKernels.inl"
@@ -0,0 +1,77 @@
+//==============================================================================
+//
+// 輝度の計算
+//
+//==============================================================================
+#include "miLuma.h"
+#include "miImageProcessing.h"
+#include "miKernels.h"
+
+#include <thread>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// 行を分割して並列に変換する
+//------------------------------------------------------------------------------
+class LumaPass : IImageProcessing {
+public:
+    LumaPass(const Image& image, unsigned char* luma) {
+        int width = image.Width();
+        Processing = [&](int startRow, int numRows) {
+            ToLuma(&image.data[startRow*width], &luma[startRow*width], numRows*width);
+        };
+        RunRows(image.Height(), std::thread::hardware_concurrency());
+    }
+};
+
+}
+
+//------------------------------------------------------------------------------
+// 画素の列を輝度の列に変換する
+//------------------------------------------------------------------------------
+void ToLuma(const RGB* pixels, unsigned char* luma, int count) {
+    CurrentKernels().toLuma((const unsigned char*)pixels, luma, count);
+}
+
+void ToLuma(const Image& image, unsigned char* luma) {
+    LumaPass pass(image, luma);
+}
+
+//------------------------------------------------------------------------------
+// 輝度の列を R = G = B の画素の列に変換する
+//------------------------------------------------------------------------------
+void FromLuma(const unsigned char* luma, RGB* pixels, int count) {
+    CurrentKernels().fromLuma(luma, (unsigned char*)pixels, count);
+}
+
+//------------------------------------------------------------------------------
+// 参照テーブルを適用した画素の輝度
+//------------------------------------------------------------------------------
+BlockLuma::BlockLuma(const unsigned char (*table)[256])
+    : table(table), identity(true) {
+    for(int c=0; table!=nullptr && c<3; c++) {
+        for(int i=0; i<256; i++) {
+            if(table[c][i] != i) identity = false;
+        }
+    }
+}
+
+void BlockLuma::operator()(const RGB* pixels, int count, unsigned char* luma) const {
+    if(!identity) {
+        RGB mapped[BlockSize];
+        for(int k=0; k<count; k++) {
+            mapped[k].r = table[0][pixels[k].r];
+            mapped[k].g = table[1][pixels[k].g];
+            mapped[k].b = table[2][pixels[k].b];
+        }
+        ToLuma(mapped, luma, count);
+    }
+    else {
+        ToLuma(pixels, luma, count);
+    }
+}
+
+}
@@ -0,0 +1,75 @@
+//==============================================================================
+//
+// 輝度の計算
+//
+//==============================================================================
+#ifndef _MI_LUMA_H_
+#define _MI_LUMA_H_
+
+#include "miImage.h"
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 輝度 Y = 0.299 R + 0.587 G + 0.114 B (切り捨て)
+//
+// MEMO:
+// 係数を 16.16 固定小数点にした整数演算で計算する
+// 係数の合計はちょうど 65536 なので、R = G = B の画素は同じ値になる
+// (double で計算した場合との差は最大 1 で、全 2^24 色のうち約 0.06%)
+//------------------------------------------------------------------------------
+const int LumaShift = 16;
+const int LumaR = 19595; // 0.299 * 65536
+const int LumaG = 38470; // 0.587 * 65536
+const int LumaB = 7471;  // 0.114 * 65536
+
+inline int Luma(int r, int g, int b) {
+    return (LumaR*r + LumaG*g + LumaB*b) >> LumaShift;
+}
+
+inline int Luma(const RGB& c) {
+    return Luma(c.r, c.g, c.b);
+}
+
+//------------------------------------------------------------------------------
+// 画素の列を輝度の列に変換する
+//
+// MEMO:
+// SSSE3 以上が使える CPU では、16画素ずつ pshufb で R,G と G,B の組に並べ替え、
+// pmaddwd で積和をとる (G の係数は 16bit に収まらないので2つに分ける)
+// 命令セットごとの実装は miKernels.inl にある
+//------------------------------------------------------------------------------
+void ToLuma(const RGB* pixels, unsigned char* luma, int count);
+
+// 画像全体 (luma は画素数分の大きさ, 並列に処理する)
+void ToLuma(const Image& image, unsigned char* luma);
+
+//------------------------------------------------------------------------------
+// 輝度の列を R = G = B の画素の列に変換する
+//------------------------------------------------------------------------------
+void FromLuma(const unsigned char* luma, RGB* pixels, int count);
+
+//------------------------------------------------------------------------------
+// 参照テーブルを適用した画素の輝度
+//
+// MEMO:
+// BlockSize 画素ずつ ToLuma でまとめて計算する (表が恒等なら画素をそのまま渡す)
+// 表はチャンネルごとの 256 要素 (nullptr なら恒等)
+//------------------------------------------------------------------------------
+class BlockLuma {
+public:
+    static const int BlockSize = 1024;
+
+    BlockLuma(const unsigned char (*table)[256] = nullptr);
+
+    // pixels から count (BlockSize 以下) 画素の輝度を luma に求める
+    void operator()(const RGB* pixels, int count, unsigned char* luma) const;
+
+private:
+    const unsigned char (*table)[256];
+    bool identity;
+};
+
+}
+
+#endif
@@ -0,0 +1,153 @@
+//==============================================================================
+//
+// 近傍処理の内側と端の分割
+//
+//==============================================================================
+#ifndef _MI_NEIGHBORHOOD_H_
+#define _MI_NEIGHBORHOOD_H_
+
+#include <algorithm>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 画像端の扱い
+//------------------------------------------------------------------------------
+enum class BorderPolicy {
+    Clamp,       // 端の画素で延長する
+    Mirror,      // 端の画素を軸に折り返す (端の画素は繰り返さない)
+    Zero,        // 画像外を 0 とする
+    Renormalize, // 画像外のタップを捨て、画像内の重みの合計で割る
+};
+
+//------------------------------------------------------------------------------
+// 座標 i を [0, n) へ移す (Zero, Renormalize では画像外なら -1)
+//------------------------------------------------------------------------------
+template<BorderPolicy Border>
+inline int MapCoordinate(int i, int n) {
+    if(i >= 0 && i < n) return i;
+
+    if(Border == BorderPolicy::Clamp) {
+        return std::min(std::max(i, 0), n-1);
+    }
+    if(Border == BorderPolicy::Mirror) {
+        if(n == 1) return 0;
+        int period = 2*(n-1);
+        i %= period;
+        if(i < 0) i += period;
+        return (i < n) ? i : period - i;
+    }
+    return -1;
+}
+
+
+//------------------------------------------------------------------------------
+// 近傍の窓と画像の内側・端の範囲
+//
+// MEMO:
+// 窓は注目画素からの相対位置 [left, right] x [top, bottom] の矩形
+// 窓がすべて画像内に収まる画素 (内側) ではタップごとの範囲チェックが要らないので、
+// ForEachRow で内側の行の範囲と端の画素を分けて渡す
+// 端の画素は Clip で窓を画像内に切り詰めるか、MapCoordinate で画像内へ移して処理する
+//------------------------------------------------------------------------------
+class Neighborhood {
+public:
+
+    //--------------------------------------------------------------------------
+    // コンストラクタ
+    //--------------------------------------------------------------------------
+    Neighborhood(int width, int height, int left, int top, int right, int bottom)
+        : width(width), height(height), left(left), top(top), right(right), bottom(bottom) {
+        beginX = std::min(width, -left);
+        endX   = std::max(beginX, width - right);
+        beginY = std::min(height, -top);
+        endY   = std::max(beginY, height - bottom);
+    }
+
+    // filterSize 四方の窓 (中心は filterSize/2, 偶数サイズでは前寄り)
+    Neighborhood(int width, int height, int filterSize)
+        : Neighborhood(width, height, -(filterSize/2), -(filterSize/2),
+                       filterSize-1-filterSize/2, filterSize-1-filterSize/2) {}
+
+
+    //--------------------------------------------------------------------------
+    // Getter
+    //--------------------------------------------------------------------------
+    int Left()   const { return left; }
+    int Top()    const { return top; }
+    int Right()  const { return right; }
+    int Bottom() const { return bottom; }
+
+    // 内側の範囲 [BeginX, EndX) x [BeginY, EndY)
+    int BeginX() const { return beginX; }
+    int EndX()   const { return endX; }
+    int BeginY() const { return beginY; }
+    int EndY()   const { return endY; }
+
+    bool IsInterior(int iX, int iY) const {
+        return iX >= beginX && iX < endX && iY >= beginY && iY < endY;
+    }
+
+
+    //--------------------------------------------------------------------------
+    // (iX, iY) の窓を画像内に切り詰めた範囲 [x0, x1] x [y0, y1]
+    //--------------------------------------------------------------------------
+    void Clip(int iX, int iY, int& x0, int& y0, int& x1, int& y1) const {
+        x0 = std::max(0, iX+left);
+        y0 = std::max(0, iY+top);
+        x1 = std::min(width-1,  iX+right);
+        y1 = std::min(height-1, iY+bottom);
+    }
+
+
+    //--------------------------------------------------------------------------
+    // startRow から numRows 行を内側と端に分けて処理する
+    // interior(iY, begin, end): 内側の行 iY の画素 [begin, end) を処理する
+    // border(iX, iY): 端の画素を1つ処理する
+    //--------------------------------------------------------------------------
+    template<class Interior, class Border>
+    void ForEachRow(int startRow, int numRows, Interior interior, Border border) const {
+        for(int iY=startRow; iY<startRow+numRows; iY++) {
+
+            // 上下の端の行
+            if(iY < beginY || iY >= endY || beginX >= endX) {
+                for(int iX=0; iX<width; iX++) border(iX, iY);
+                continue;
+            }
+
+            for(int iX=0; iX<beginX; iX++) border(iX, iY);
+            interior(iY, beginX, endX);
+            for(int iX=endX; iX<width; iX++) border(iX, iY);
+        }
+    }
+
+
+    //--------------------------------------------------------------------------
+    // startRow から numRows 行の画素ごとに process(iX, iY, x0, y0, x1, y1) を呼ぶ
+    // [x0, x1] x [y0, y1] は画像内の窓 (内側の画素では切り詰めない)
+    //--------------------------------------------------------------------------
+    template<class Process>
+    void ForEachWindow(int startRow, int numRows, Process process) const {
+        ForEachRow(startRow, numRows,
+            [&](int iY, int begin, int end) {
+                for(int iX=begin; iX<end; iX++) {
+                    process(iX, iY, iX+left, iY+top, iX+right, iY+bottom);
+                }
+            },
+            [&](int iX, int iY) {
+                int x0, y0, x1, y1;
+                Clip(iX, iY, x0, y0, x1, y1);
+                process(iX, iY, x0, y0, x1, y1);
+            });
+    }
+
+private:
+    int width;
+    int height;
+    int left, top, right, bottom;
+    int beginX, endX, beginY, endY;
+};
+
+}
+
+#endif
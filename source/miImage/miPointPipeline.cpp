@@ -0,0 +1,201 @@
+//==============================================================================
+//
+// 点処理のパイプライン
+//
+//==============================================================================
+#include "miPointPipeline.h"
+
+#include "miImageProcessing.h"
+#include "miImageStatistics.h"
+#include "miLuma.h"
+#include "miKernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace mi {
+
+namespace {
+
+//------------------------------------------------------------------------------
+// 画素ごとの処理を分割実行する
+//------------------------------------------------------------------------------
+class PointPass : IImageProcessing {
+public:
+    PointPass(Image& image, const std::function<void(int, int)>& process) {
+        Processing = process;
+        Run(image, std::thread::hardware_concurrency());
+    }
+};
+
+void SetIdentity(unsigned char (*table)[256]) {
+    for(int c=0; c<3; c++) {
+        for(int i=0; i<256; i++) table[c][i] = (unsigned char)i;
+    }
+}
+
+}
+
+//------------------------------------------------------------------------------
+// 段の追加
+//------------------------------------------------------------------------------
+PointPipeline& PointPipeline::Lut(const unsigned char* table) {
+    return Lut(table, table, table);
+}
+
+PointPipeline& PointPipeline::Lut(const unsigned char* tableR, const unsigned char* tableG, const unsigned char* tableB) {
+    Stage stage;
+    stage.type = Stage::Table;
+    std::copy(tableR, tableR+256, stage.table[0]);
+    std::copy(tableG, tableG+256, stage.table[1]);
+    std::copy(tableB, tableB+256, stage.table[2]);
+    stages.push_back(stage);
+    return *this;
+}
+
+PointPipeline& PointPipeline::Monochrome() {
+    Stage stage;
+    stage.type = Stage::Luma;
+    stages.push_back(stage);
+    return *this;
+}
+
+PointPipeline& PointPipeline::Binarize(int threshold) {
+    unsigned char LUT[256];
+    for(int i=0; i<256; i++) {
+        LUT[i] = (i > threshold) ? 255 : 0;
+    }
+    return Monochrome().Lut(LUT);
+}
+
+PointPipeline& PointPipeline::Gamma(double param) {
+    unsigned char LUT[256];
+    for(int i=0; i<256; i++) {
+        LUT[i] = (unsigned char)(255*pow(i/255.0,1.0/param));
+    }
+    return Lut(LUT);
+}
+
+PointPipeline& PointPipeline::Logistic(double paramA, double paramB) {
+    unsigned char LUT[256];
+    for(int i=0; i<256; i++) {
+        LUT[i] = (unsigned char)( 255/(1+exp(-paramA*(i-paramB))) );
+    }
+    return Lut(LUT);
+}
+
+PointPipeline& PointPipeline::HistgramExtention() {
+    Stage stage;
+    stage.type = Stage::Extention;
+    stages.push_back(stage);
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+// パイプラインを画像に適用する
+//------------------------------------------------------------------------------
+void PointPipeline::Process(Image& image) const {
+
+    if(stages.empty() || image.Size() == 0) return;
+
+    // 合成した表
+    // 輝度化の前: pre[c][入力の値], 輝度化の後: post[c][輝度]
+    unsigned char pre[3][256];
+    unsigned char post[3][256];
+    bool luma = false;
+
+    SetIdentity(pre);
+
+    for(const auto& stage : stages) {
+
+        const unsigned char (*table)[256] = stage.table;
+        unsigned char extention[3][256];
+
+        switch(stage.type) {
+
+        case Stage::Luma:
+            if(!luma) {
+                luma = true;
+                SetIdentity(post);
+            }
+            else {
+                // 2回目以降は輝度に対する表になる
+                for(int i=0; i<256; i++) {
+                    unsigned char Y = (unsigned char)Luma(post[0][i], post[1][i], post[2][i]);
+                    post[0][i] = post[1][i] = post[2][i] = Y;
+                }
+            }
+            continue;
+
+        case Stage::Extention: {
+            // ここまでを合成した結果の輝度の最大値・最小値
+            // (現れる輝度を調べ、輝度化の後なら輝度に対する出力の輝度でとる)
+            ImageStatistics statistics(image, ImageStatistics::LumaChannel, pre);
+            const long long* histgram = statistics.Histgram(ImageStatistics::Y);
+
+            int min = 255;
+            int max = 0;
+            for(int i=0; i<256; i++) {
+                if(histgram[i] == 0) continue;
+                int Y = luma ? Luma(post[0][i], post[1][i], post[2][i]) : i;
+                min = std::min(min, Y);
+                max = std::max(max, Y);
+            }
+
+            for(int i=0; i<256; i++) {
+                extention[0][i] = (unsigned char)(255.0 / (max-min) * (i-min));
+            }
+            std::copy(extention[0], extention[0]+256, extention[1]);
+            std::copy(extention[0], extention[0]+256, extention[2]);
+            table = extention;
+            break;
+        }
+
+        case Stage::Table:
+            break;
+        }
+
+        // 参照テーブルを合成する
+        unsigned char (*target)[256] = luma ? post : pre;
+        for(int c=0; c<3; c++) {
+            for(int i=0; i<256; i++) target[c][i] = table[c][target[c][i]];
+        }
+    }
+
+    // 合成した表を1回の走査で適用する
+    if(!luma) {
+        const Kernels& kernels = CurrentKernels();
+        PointPass(image, [&](int start, int length) {
+            unsigned char* data = (unsigned char*)&image.data[start];
+            kernels.applyTables(data, pre, data, length);
+        });
+    }
+    else {
+        // 輝度化の後の表が3チャンネルで同じなら出力は R = G = B になるので、
+        // 輝度の列に表を適用してから FromLuma で広げる
+        BlockLuma blockLuma(pre);
+        bool gray = std::equal(post[0], post[0]+256, post[1]) &&
+                    std::equal(post[0], post[0]+256, post[2]);
+        PointPass(image, [&](int start, int length) {
+            RGB* data = image.data;
+            unsigned char Y[BlockLuma::BlockSize];
+            for(int i=start; i<start+length; i+=BlockLuma::BlockSize) {
+                int count = std::min(BlockLuma::BlockSize, start+length-i);
+                blockLuma(&data[i], count, Y);
+                if(gray) {
+                    for(int k=0; k<count; k++) Y[k] = post[0][Y[k]];
+                    FromLuma(Y, &data[i], count);
+                    continue;
+                }
+                for(int k=0; k<count; k++) {
+                    data[i+k].r = post[0][Y[k]];
+                    data[i+k].g = post[1][Y[k]];
+                    data[i+k].b = post[2][Y[k]];
+                }
+            }
+        });
+    }
+}
+
+}
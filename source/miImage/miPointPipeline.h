@@ -0,0 +1,81 @@
+//==============================================================================
+//
+// 点処理のパイプライン
+//
+//==============================================================================
+#ifndef _MI_POINT_PIPELINE_H_
+#define _MI_POINT_PIPELINE_H_
+
+#include "miImage.h"
+#include <vector>
+
+namespace mi {
+
+//------------------------------------------------------------------------------
+// 点処理のパイプライン
+//
+// MEMO:
+// 画素ごとに独立した処理 (チャンネルごとの参照テーブルと輝度化) を並べておき、
+// Process でチャンネルごとの 256 要素の表にまとめてから、画像を1回だけ走査して適用する
+// 輝度化より前の表は輝度化の入力側に、後の表は輝度に対する表に合成する
+// (2回目以降の輝度化は輝度に対する表になるので、輝度化は高々1回で済む)
+// HistgramExtention のように画像から表を作る段では、そこまでを合成した結果の
+// 輝度の範囲を求めるため、読み込みだけの走査が1回増える
+//------------------------------------------------------------------------------
+class PointPipeline {
+public:
+
+    //--------------------------------------------------------------------------
+    // 段の追加
+    //--------------------------------------------------------------------------
+
+    // 参照テーブル (3チャンネル共通, チャンネルごと)
+    PointPipeline& Lut(const unsigned char* table);
+    PointPipeline& Lut(const unsigned char* tableR, const unsigned char* tableG, const unsigned char* tableB);
+
+    // モノクロ化 (Monochrome と同じ)
+    PointPipeline& Monochrome();
+
+    // 2値化 (Binarize と同じ)
+    PointPipeline& Binarize(int threshold);
+
+    // ガンマ補正 (GammaCollection と同じ)
+    PointPipeline& Gamma(double param);
+
+    // Logistic フィルタ (LogisticFilter と同じ)
+    PointPipeline& Logistic(double paramA, double paramB);
+
+    // ヒストグラム伸張 (HistgramExtention と同じ)
+    PointPipeline& HistgramExtention();
+
+
+    //--------------------------------------------------------------------------
+    // 段数
+    //--------------------------------------------------------------------------
+    int Size() const { return (int)stages.size(); }
+
+
+    //--------------------------------------------------------------------------
+    // パイプラインを画像に適用する
+    //--------------------------------------------------------------------------
+    void Process(Image& image) const;
+
+private:
+
+    // 段
+    struct Stage {
+        enum Type {
+            Table,     // チャンネルごとの参照テーブル
+            Luma,      // 輝度化 (r = g = b = 輝度)
+            Extention, // 輝度の範囲から作る伸張のテーブル
+        };
+        Type type;
+        unsigned char table[3][256];
+    };
+
+    std::vector<Stage> stages;
+};
+
+}
+
+#endif